@@ -0,0 +1,289 @@
+// Drives OpenFile and SaveFile against a running daemon on the session bus,
+// keeping a fixed number of calls in flight, and prints one line per run:
+//
+//   e2e method=OpenFile concurrency=8 calls=256 failures=0 p50_us=... ...
+//
+// usage: e2e-bench <daemon pid> <calls> <concurrency>...
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef HAVE_LIBSYSTEMD
+#include <systemd/sd-bus.h>
+#elif HAVE_LIBELOGIND
+#include <elogind/sd-bus.h>
+#elif HAVE_BASU
+#include <basu/sd-bus.h>
+#endif
+
+static const char service_name[] =
+    "org.freedesktop.impl.portal.desktop.termfilechooser";
+static const char object_path[] = "/org/freedesktop/portal/desktop";
+static const char interface_name[] = "org.freedesktop.impl.portal.FileChooser";
+
+struct bench_run {
+    sd_bus *bus;
+    const char *method;
+    int calls;
+    int started;
+    int finished;
+    int in_flight;
+    int failures;
+    uint64_t *latencies;
+};
+
+struct bench_call {
+    struct bench_run *run;
+    uint64_t start_usec;
+};
+
+static uint64_t now_usec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int on_reply(sd_bus_message *reply, void *data, sd_bus_error *ret_error)
+{
+    struct bench_call *call = data;
+    struct bench_run *run = call->run;
+    uint32_t response = 2;
+
+    if (sd_bus_message_is_method_error(reply, NULL)) {
+        fprintf(stderr, "e2e: %s failed: %s\n", run->method,
+                sd_bus_message_get_error(reply)->message);
+    } else if (sd_bus_message_read(reply, "u", &response) < 0) {
+        response = 2;
+    }
+
+    if (response != 0) {
+        run->failures++;
+    }
+    run->latencies[run->finished++] = now_usec() - call->start_usec;
+    run->in_flight--;
+    free(call);
+    return 0;
+}
+
+static int start_call(struct bench_run *run)
+{
+    sd_bus_message *msg = NULL;
+    int ret = sd_bus_message_new_method_call(run->bus, &msg, service_name,
+                                             object_path, interface_name,
+                                             run->method);
+    if (ret < 0) {
+        return ret;
+    }
+
+    size_t handle_size =
+        1 + snprintf(NULL, 0, "/org/freedesktop/portal/desktop/request/1_0/b%d",
+                     run->started);
+    char *handle = malloc(handle_size);
+    snprintf(handle, handle_size,
+             "/org/freedesktop/portal/desktop/request/1_0/b%d", run->started);
+
+    bool save = strcmp(run->method, "SaveFile") == 0;
+    ret = sd_bus_message_append(msg, "osss", handle, "org.example.Bench", "",
+                                "bench");
+    if (ret < 0) {
+        goto cleanup;
+    }
+    if (save) {
+        ret = sd_bus_message_append(msg, "a{sv}", 1, "current_name", "s",
+                                    "bench.txt");
+    } else {
+        ret = sd_bus_message_append(msg, "a{sv}", 1, "multiple", "b", 1);
+    }
+    if (ret < 0) {
+        goto cleanup;
+    }
+
+    struct bench_call *call = malloc(sizeof(struct bench_call));
+    call->run = run;
+    call->start_usec = now_usec();
+    ret = sd_bus_call_async(run->bus, NULL, msg, on_reply, call, UINT64_MAX);
+    if (ret < 0) {
+        free(call);
+        goto cleanup;
+    }
+    run->started++;
+    run->in_flight++;
+
+cleanup:
+    free(handle);
+    sd_bus_message_unref(msg);
+    return ret;
+}
+
+static int compare_latency(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static uint64_t percentile(const uint64_t *sorted, int count, double quantile)
+{
+    int index = quantile * count;
+    return sorted[index < count ? index : count - 1];
+}
+
+static int run_bench(sd_bus *bus, const char *method, int calls,
+                     int concurrency)
+{
+    struct bench_run run = {
+        .bus = bus,
+        .method = method,
+        .calls = calls,
+        .latencies = calloc(calls, sizeof(uint64_t)),
+    };
+
+    int ret = 0;
+    uint64_t start_usec = now_usec();
+    while (run.finished < calls) {
+        while (run.started < calls && run.in_flight < concurrency) {
+            ret = start_call(&run);
+            if (ret < 0) {
+                fprintf(stderr, "e2e: could not call %s: %s\n", method,
+                        strerror(-ret));
+                goto cleanup;
+            }
+        }
+
+        ret = sd_bus_process(bus, NULL);
+        if (ret < 0) {
+            fprintf(stderr, "e2e: bus error: %s\n", strerror(-ret));
+            goto cleanup;
+        }
+        if (ret == 0) {
+            ret = sd_bus_wait(bus, UINT64_MAX);
+            if (ret < 0 && ret != -EINTR) {
+                fprintf(stderr, "e2e: bus error: %s\n", strerror(-ret));
+                goto cleanup;
+            }
+        }
+    }
+    uint64_t elapsed_usec = now_usec() - start_usec;
+
+    qsort(run.latencies, calls, sizeof(uint64_t), compare_latency);
+    uint64_t sum = 0;
+    for (int i = 0; i < calls; i++) {
+        sum += run.latencies[i];
+    }
+    printf("e2e method=%s concurrency=%d calls=%d failures=%d mean_us=%lu "
+           "p50_us=%lu p95_us=%lu p99_us=%lu max_us=%lu throughput=%.1f/s\n",
+           method, concurrency, calls, run.failures,
+           (unsigned long)(sum / calls),
+           (unsigned long)percentile(run.latencies, calls, 0.50),
+           (unsigned long)percentile(run.latencies, calls, 0.95),
+           (unsigned long)percentile(run.latencies, calls, 0.99),
+           (unsigned long)run.latencies[calls - 1],
+           elapsed_usec ? calls * 1e6 / elapsed_usec : 0.0);
+    fflush(stdout);
+    ret = run.failures ? -EIO : 0;
+
+cleanup:
+    free(run.latencies);
+    return ret;
+}
+
+static int wait_for_daemon(sd_bus *bus)
+{
+    for (int i = 0; i < 500; i++) {
+        sd_bus_error error = SD_BUS_ERROR_NULL;
+        sd_bus_message *reply = NULL;
+        int has_owner = 0;
+        int ret = sd_bus_call_method(bus, "org.freedesktop.DBus",
+                                     "/org/freedesktop/DBus",
+                                     "org.freedesktop.DBus", "NameHasOwner",
+                                     &error, &reply, "s", service_name);
+        if (ret >= 0) {
+            sd_bus_message_read(reply, "b", &has_owner);
+        }
+        sd_bus_message_unref(reply);
+        sd_bus_error_free(&error);
+        if (has_owner) {
+            return 0;
+        }
+        nanosleep(&(struct timespec){.tv_nsec = 10000000}, NULL);
+    }
+    return -ETIMEDOUT;
+}
+
+// VmHWM is the high water mark of the resident set
+static long peak_rss_kb(long pid)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%ld/status", pid);
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        return -1;
+    }
+
+    long rss = -1;
+    char line[256];
+    while (fgets(line, sizeof(line), fp)) {
+        if (sscanf(line, "VmHWM: %ld", &rss) == 1) {
+            break;
+        }
+    }
+    fclose(fp);
+    return rss;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 4) {
+        fprintf(stderr, "usage: %s <daemon pid> <calls> <concurrency>...\n",
+                argv[0]);
+        return 1;
+    }
+
+    long pid = strtol(argv[1], NULL, 10);
+    int calls = strtol(argv[2], NULL, 10);
+    if (calls < 1) {
+        fprintf(stderr, "e2e: need at least one call\n");
+        return 1;
+    }
+
+    sd_bus *bus = NULL;
+    int ret = sd_bus_open_user(&bus);
+    if (ret < 0) {
+        fprintf(stderr, "e2e: could not connect to the session bus: %s\n",
+                strerror(-ret));
+        return 1;
+    }
+
+    ret = wait_for_daemon(bus);
+    if (ret < 0) {
+        fprintf(stderr, "e2e: %s did not show up on the bus\n", service_name);
+        goto cleanup;
+    }
+
+    static const char *const methods[] = {"OpenFile", "SaveFile"};
+    for (int i = 3; i < argc; i++) {
+        int concurrency = strtol(argv[i], NULL, 10);
+        if (concurrency < 1) {
+            fprintf(stderr, "e2e: invalid concurrency '%s'\n", argv[i]);
+            ret = -EINVAL;
+            goto cleanup;
+        }
+        for (size_t j = 0; j < sizeof(methods) / sizeof(methods[0]); j++) {
+            int r = run_bench(bus, methods[j], calls, concurrency);
+            if (r < 0) {
+                ret = r;
+            }
+        }
+    }
+
+    printf("e2e peak_rss_kb=%ld\n", peak_rss_kb(pid));
+
+cleanup:
+    sd_bus_flush_close_unref(bus);
+    return ret < 0 ? 1 : 0;
+}
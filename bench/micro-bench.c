@@ -0,0 +1,440 @@
+// Times the CPU bound paths of the daemon in isolation and prints one line
+// per case:
+//
+//   micro name=uri_encode input=utf8.avx2 bytes=4096 items=1 iterations=...
+//         ns_per_op=... ns_per_item=... mb_per_s=...
+//
+// usage: micro-bench [filter]
+//
+// Only cases whose name starts with the filter are run. XDPTF_BENCH_MIN_MS
+// sets how long each case runs (200).
+#define _GNU_SOURCE
+#include "config.h"
+#include "filter.h"
+#include "logger.h"
+#include "selection.h"
+#include "stat_batch.h"
+#include "uri.h"
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define INPUT_SIZE 4096
+
+typedef void (*bench_fn)(void *arg);
+
+static uint64_t min_ns = 200 * 1000000ULL;
+static const char *filter = NULL;
+
+// keeps the compiler from dropping the work whose result is never used
+static volatile size_t sink;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// runs fn in growing batches until min_ns has passed, so the clock is read
+// rarely enough not to show up in short cases
+static void run(const char *name, const char *input, size_t bytes,
+                size_t items, bench_fn fn, void *arg)
+{
+    if (filter && strncmp(name, filter, strlen(filter)) != 0) {
+        return;
+    }
+
+    fn(arg);
+
+    uint64_t iterations = 0, batch = 1, elapsed = 0;
+    uint64_t start = now_ns();
+    while (elapsed < min_ns) {
+        for (uint64_t i = 0; i < batch; i++) {
+            fn(arg);
+        }
+        iterations += batch;
+        elapsed = now_ns() - start;
+        if (elapsed < min_ns / 16) {
+            batch *= 2;
+        }
+    }
+
+    double ns_per_op = (double)elapsed / iterations;
+    printf("micro name=%s input=%s bytes=%zu items=%zu iterations=%lu "
+           "ns_per_op=%.1f ns_per_item=%.1f mb_per_s=%.1f\n",
+           name, input, bytes, items, (unsigned long)iterations, ns_per_op,
+           ns_per_op / (items ? items : 1),
+           bytes ? bytes * 1e3 / ns_per_op : 0.0);
+    fflush(stdout);
+}
+
+struct uri_case {
+    const char *src;
+    size_t len;
+    char *dst;
+};
+
+static void bench_uri_encode(void *arg)
+{
+    struct uri_case *c = arg;
+    sink = uri_encode(c->src, c->len, c->dst);
+}
+
+static void bench_uri_decode(void *arg)
+{
+    struct uri_case *c = arg;
+    sink = uri_decode(c->src, c->len, c->dst);
+}
+
+// fills size bytes by repeating pattern, without cutting a UTF-8 sequence
+static char *repeat(const char *pattern, size_t size)
+{
+    size_t plen = strlen(pattern);
+    char *buf = malloc(size + 1);
+    size_t len = 0;
+    while (len + plen <= size) {
+        memcpy(buf + len, pattern, plen);
+        len += plen;
+    }
+    while (len < size) {
+        buf[len++] = 'a';
+    }
+    buf[len] = '\0';
+    return buf;
+}
+
+static void bench_uri(void)
+{
+    char worst[257];
+    for (int i = 0; i < 256; i++) {
+        worst[i] = (char)(i == 0 ? 0x80 : i);
+    }
+    worst[256] = '\0';
+
+    struct {
+        const char *name;
+        char *data;
+        size_t len;
+    } inputs[] = {
+        {"path", strdup("/home/user/Documents/projects/report-2024_final.txt")},
+        {"ascii", repeat("/home/user/src/project/module_name/file-01.c", INPUT_SIZE)},
+        {"utf8", repeat("/home/用户/Документы/写真/ファイル名 ñ.png", INPUT_SIZE)},
+        {"worst", repeat(worst, INPUT_SIZE)},
+    };
+
+    static const char *const kernels[] = {"avx2", "sse2", "scalar"};
+    const char *best = uri_kernel();
+
+    for (size_t i = 0; i < sizeof(inputs) / sizeof(inputs[0]); i++) {
+        size_t len = strlen(inputs[i].data);
+        char *encoded = malloc(1 + len * 3);
+        char *decoded = malloc(1 + len * 3);
+
+        for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+            if (uri_set_kernel(kernels[k]) < 0) {
+                continue;
+            }
+            char input[32];
+            snprintf(input, sizeof(input), "%s.%s", inputs[i].name,
+                     kernels[k]);
+
+            struct uri_case encode = {inputs[i].data, len, encoded};
+            run("uri_encode", input, len, 1, bench_uri_encode, &encode);
+
+            size_t encoded_len = uri_encode(inputs[i].data, len, encoded);
+            struct uri_case decode = {encoded, encoded_len, decoded};
+            run("uri_decode", input, encoded_len, 1, bench_uri_decode,
+                &decode);
+        }
+
+        free(encoded);
+        free(decoded);
+        free(inputs[i].data);
+    }
+    uri_set_kernel(best);
+}
+
+struct selection_case {
+    char *data;
+    size_t size;
+};
+
+// stands in for appending to the reply, which is not what is measured here
+static int count_uri(void *data, size_t index, const char *uri)
+{
+    sink += strlen(uri);
+    return 0;
+}
+
+static void bench_selection_parse(void *arg)
+{
+    struct selection_case *c = arg;
+    struct xdptf_arena arena = {0};
+    struct selection selection = {0};
+    if (selection_parse(&arena, c->data, c->size, "/home/user", NULL,
+                        SELECTION_ANY, NULL, count_uri, NULL, &selection) < 0) {
+        abort();
+    }
+    sink = selection.count;
+    xdptf_arena_reset(&arena);
+}
+
+static void bench_selection(void)
+{
+    static const size_t line_counts[] = {1, 100, 10000, 1000000};
+    for (size_t i = 0; i < sizeof(line_counts) / sizeof(line_counts[0]); i++) {
+        size_t lines = line_counts[i];
+        char *data = NULL;
+        size_t size = 0;
+        FILE *fp = open_memstream(&data, &size);
+        for (size_t j = 0; j < lines; j++) {
+            fprintf(fp, "/home/user/Pictures/2024/holiday photo %07zu.jpg\n",
+                    j);
+        }
+        fclose(fp);
+
+        char input[32];
+        snprintf(input, sizeof(input), "lines_%zu", lines);
+        struct selection_case c = {data, size};
+        run("selection_parse", input, size, lines, bench_selection_parse, &c);
+        free(data);
+    }
+
+    // relative paths, every one of them twice, as nnn and lf may write them
+    char *data = NULL;
+    size_t size = 0;
+    FILE *fp = open_memstream(&data, &size);
+    for (size_t j = 0; j < 10000; j++) {
+        fprintf(fp, "Pictures/2024/holiday photo %07zu.jpg\n", j / 2);
+    }
+    fclose(fp);
+    struct selection_case c = {data, size};
+    run("selection_parse", "duplicates_10000", size, 10000,
+        bench_selection_parse, &c);
+    free(data);
+}
+
+struct filter_case {
+    struct filter *filter;
+    char **names;
+    size_t count;
+};
+
+static void bench_filter_match(void *arg)
+{
+    struct filter_case *c = arg;
+    size_t matched = 0;
+    for (size_t i = 0; i < c->count; i++) {
+        matched += filter_match(c->filter, c->names[i], strlen(c->names[i]));
+    }
+    sink = matched;
+}
+
+// the cost per name should not grow with the number of *.ext patterns
+static void bench_filter(void)
+{
+    static const char *const exts[] = {"jpg", "png", "gif", "webp", "tiff",
+                                       "bmp", "svg", "heic", "avif", "raw"};
+    const size_t num_exts = sizeof(exts) / sizeof(exts[0]);
+    const size_t count = 1000;
+    char **names = calloc(count, sizeof(*names));
+    for (size_t i = 0; i < count; i++) {
+        if (asprintf(&names[i], "/home/user/Pictures/photo %04zu.%s", i,
+                     i % 2 ? exts[i % num_exts] : "txt") < 0) {
+            abort();
+        }
+    }
+
+    static const size_t pattern_counts[] = {1, 10, 100};
+    for (size_t i = 0; i < sizeof(pattern_counts) / sizeof(pattern_counts[0]);
+         i++) {
+        struct xdptf_arena arena = {0};
+        struct filter filter;
+        filter_init(&filter, &arena);
+        char pattern[32];
+        for (size_t j = 0; j < pattern_counts[i]; j++) {
+            snprintf(pattern, sizeof(pattern), "*.%s%.0zu", exts[j % num_exts],
+                     j / num_exts);
+            filter_add(&filter, pattern);
+        }
+
+        char input[32];
+        snprintf(input, sizeof(input), "patterns_%zu", pattern_counts[i]);
+        struct filter_case c = {&filter, names, count};
+        run("filter_match", input, 0, count, bench_filter_match, &c);
+        xdptf_arena_reset(&arena);
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        free(names[i]);
+    }
+    free(names);
+}
+
+struct stat_batch_case {
+    const char *const *paths;
+    size_t count;
+    int *types;
+};
+
+static void bench_stat_batch_fn(void *arg)
+{
+    struct stat_batch_case *c = arg;
+    stat_batch(c->paths, c->count, c->types);
+    sink = c->types[c->count - 1];
+}
+
+// files in a fresh directory, so the page cache answers
+static void bench_stat_batch(void)
+{
+    static const size_t counts[] = {1, 100, 1000};
+    const size_t max_count = counts[sizeof(counts) / sizeof(counts[0]) - 1];
+    char dir[] = "/tmp/xdptf-bench-XXXXXX";
+    if (mkdtemp(dir) == NULL) {
+        perror("mkdtemp");
+        return;
+    }
+
+    char **paths = calloc(max_count, sizeof(*paths));
+    int *types = calloc(max_count, sizeof(*types));
+    for (size_t i = 0; i < max_count; i++) {
+        if (asprintf(&paths[i], "%s/file %04zu.jpg", dir, i) < 0) {
+            abort();
+        }
+        int fd = open(paths[i], O_WRONLY | O_CREAT | O_EXCL, 0600);
+        if (fd < 0) {
+            abort();
+        }
+        close(fd);
+    }
+
+    for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+        char input[32];
+        snprintf(input, sizeof(input), "files_%zu", counts[i]);
+        struct stat_batch_case c = {(const char *const *)paths, counts[i],
+                                    types};
+        run("stat_batch", input, 0, counts[i], bench_stat_batch_fn, &c);
+    }
+
+    for (size_t i = 0; i < max_count; i++) {
+        unlink(paths[i]);
+        free(paths[i]);
+    }
+    rmdir(dir);
+    free(paths);
+    free(types);
+}
+
+static void bench_shell_expand(void *arg)
+{
+    char *expanded = shell_expand(arg);
+    sink = strlen(expanded);
+    free(expanded);
+}
+
+static void bench_expand(void)
+{
+    static const struct {
+        const char *name;
+        const char *value;
+    } inputs[] = {
+        {"plain", "/usr/share/xdg-desktop-portal-termfilechooser/yazi-wrapper.sh"},
+        {"variable", "$HOME/.local/share/xdg-desktop-portal-termfilechooser"},
+        {"tilde", "~/Downloads"},
+        {"quoted", "kitty --title 'termfilechooser' --class \"picker\""},
+    };
+
+    for (size_t i = 0; i < sizeof(inputs) / sizeof(inputs[0]); i++) {
+        run("shell_expand", inputs[i].name, strlen(inputs[i].value), 1,
+            bench_shell_expand, (void *)inputs[i].value);
+    }
+}
+
+static void bench_init_config(void *arg)
+{
+    char *configfile = strdup(arg);
+    struct config_filechooser config = {0};
+    init_config(&configfile, &config);
+    free_config(&config);
+    free(configfile);
+}
+
+static void bench_config(void)
+{
+    static const size_t env_counts[] = {0, 100, 1000};
+    char path[] = "/tmp/xdptf-micro-bench-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        perror("mkstemp");
+        return;
+    }
+    close(fd);
+
+    for (size_t i = 0; i < sizeof(env_counts) / sizeof(env_counts[0]); i++) {
+        FILE *fp = fopen(path, "w");
+        fprintf(fp, "[filechooser]\n"
+                    "cmd=/bin/true\n"
+                    "default_dir=$HOME/Downloads\n"
+                    "open_mode=suggested\n"
+                    "save_mode=last\n"
+                    "create_help_file=1\n");
+        for (size_t j = 0; j < env_counts[i]; j++) {
+            fprintf(fp, "env=XDPTF_BENCH_VAR_%zu=value $HOME %zu\n", j, j);
+        }
+        long size = ftell(fp);
+        fclose(fp);
+
+        char input[32];
+        snprintf(input, sizeof(input), "env_%zu", env_counts[i]);
+        run("init_config", input, size, 6 + env_counts[i], bench_init_config,
+            path);
+    }
+    unlink(path);
+}
+
+static void bench_logprint(void *arg)
+{
+    logprint(INFO, "filechooser: %d. %s", 42,
+             "file:///home/user/Documents/report.pdf");
+}
+
+static void bench_logger(void)
+{
+    FILE *devnull = fopen("/dev/null", "w");
+    static const char *const levels[] = {"QUIET", "ERROR", "WARN",
+                                         "INFO",  "DEBUG", "TRACE"};
+    for (size_t i = 0; i < sizeof(levels) / sizeof(levels[0]); i++) {
+        init_logger(devnull, get_loglevel(levels[i]));
+        run("logprint", levels[i], 0, 1, bench_logprint, NULL);
+    }
+    init_logger(stderr, QUIET);
+    fclose(devnull);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *min_ms = getenv("XDPTF_BENCH_MIN_MS");
+    if (min_ms && *min_ms) {
+        min_ns = strtoull(min_ms, NULL, 10) * 1000000;
+    }
+    if (argc > 1) {
+        filter = argv[1];
+    }
+
+    // the parsers log; keep that out of everything but the logprint cases
+    init_logger(stderr, QUIET);
+
+    bench_uri();
+    bench_selection();
+    bench_filter();
+    bench_stat_batch();
+    bench_expand();
+    bench_config();
+    bench_logger();
+    return 0;
+}
@@ -0,0 +1,62 @@
+#!/bin/sh
+# Starts a private session bus and the daemon with a config pointing at the
+# stub chooser, then runs the load driver against it.
+#
+# usage: run-e2e.sh <daemon> <stub-chooser> <e2e-bench>
+#
+# XDPTF_BENCH_CALLS        calls per run (256)
+# XDPTF_BENCH_CONCURRENCY  concurrency levels ("1 8 64")
+# XDPTF_BENCH_SELECTIONS   paths the stub returns for OpenFile (1)
+# XDPTF_BENCH_DELAY_MS     time the stub takes to "choose" (0)
+
+set -eu
+
+daemon="$1"
+stub="$2"
+driver="$3"
+
+tmp="$(mktemp -d)"
+bus_pid=
+daemon_pid=
+
+finish() {
+	[ -n "$daemon_pid" ] && kill "$daemon_pid" 2>/dev/null && wait "$daemon_pid" 2>/dev/null
+	[ -n "$bus_pid" ] && kill "$bus_pid" 2>/dev/null
+	rm -rf "$tmp"
+}
+trap finish EXIT
+trap 'exit 1' INT TERM
+
+mkdir -m 0700 "$tmp/runtime" "$tmp/home"
+export XDG_RUNTIME_DIR="$tmp/runtime"
+export HOME="$tmp/home"
+export XDPTF_BENCH_SELECTIONS="${XDPTF_BENCH_SELECTIONS:-1}"
+export XDPTF_BENCH_DELAY_MS="${XDPTF_BENCH_DELAY_MS:-0}"
+
+dbus-daemon --session --fork --nopidfile \
+	--address="unix:path=$tmp/bus" --print-pid=3 3>"$tmp/bus.pid"
+bus_pid="$(cat "$tmp/bus.pid")"
+export DBUS_SESSION_BUS_ADDRESS="unix:path=$tmp/bus"
+
+cat >"$tmp/config" <<CONFIG
+[filechooser]
+cmd=$stub
+default_dir=$tmp/home
+create_help_file=0
+open_mode=default
+save_mode=default
+CONFIG
+
+# OpenFile drops paths that do not exist, so the stub's have to; it
+# returns at least one
+i=0
+while [ "$i" -lt "$XDPTF_BENCH_SELECTIONS" ] || [ "$i" -eq 0 ]; do
+	: >"$tmp/home/selection-$i"
+	i=$((i + 1))
+done
+
+"$daemon" --config="$tmp/config" --loglevel=ERROR &
+daemon_pid=$!
+
+"$driver" "$daemon_pid" "${XDPTF_BENCH_CALLS:-256}" \
+	${XDPTF_BENCH_CONCURRENCY:-1 8 64}
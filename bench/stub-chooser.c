@@ -0,0 +1,59 @@
+// Stand-in for a wrapper script: takes the usual six arguments and writes
+// XDPTF_BENCH_SELECTIONS paths to the output after XDPTF_BENCH_DELAY_MS.
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static long env_long(const char *name, long fallback)
+{
+    const char *value = getenv(name);
+    if (value == NULL || *value == '\0') {
+        return fallback;
+    }
+    return strtol(value, NULL, 10);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 6) {
+        fprintf(stderr, "usage: %s multiple directory save path out [debug]\n",
+                argv[0]);
+        return 1;
+    }
+
+    bool multiple = strcmp(argv[1], "1") == 0;
+    bool save = strcmp(argv[3], "1") == 0;
+    const char *path = argv[4];
+    const char *out = argv[5];
+
+    long delay_ms = env_long("XDPTF_BENCH_DELAY_MS", 0);
+    if (delay_ms > 0) {
+        struct timespec ts = {
+            .tv_sec = delay_ms / 1000,
+            .tv_nsec = (delay_ms % 1000) * 1000000,
+        };
+        nanosleep(&ts, NULL);
+    }
+
+    // SaveFile takes exactly one path, OpenFile without multiple one as well
+    long selections = env_long("XDPTF_BENCH_SELECTIONS", 1);
+    if (save || !multiple || selections < 1) {
+        selections = 1;
+    }
+
+    FILE *fp = fopen(out, "w");
+    if (fp == NULL) {
+        perror(out);
+        return 1;
+    }
+    if (save) {
+        fprintf(fp, "%s\n", path);
+    } else {
+        for (long i = 0; i < selections; i++) {
+            fprintf(fp, "%s/selection-%ld\n", path, i);
+        }
+    }
+    return fclose(fp) == 0 ? 0 : 1;
+}
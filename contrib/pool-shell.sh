@@ -0,0 +1,38 @@
+#!/usr/bin/env sh
+# This helper is used by xdg-desktop-portal-termfilechooser when pool_size is
+# set. It is not meant to be used as a wrapper.
+#
+# serve <fifo> <done>: runs inside a pre-spawned terminal. Waits for a command
+# on <fifo>, runs it and reports its exit code on <done>.
+#
+# attach <fifo> <done> <command> [args...]: set as TERMCMD for the wrapper.
+# Hands the command to the waiting terminal and exits with its exit code.
+
+action="$1"
+fifo="$2"
+done="$3"
+shift 3
+
+case "$action" in
+    serve)
+        command=$(cat "$fifo")
+        printf '\033]2;%s\007' "termfilechooser"
+        sh -c "$command"
+        printf '%s\n' "$?" > "$done"
+        ;;
+    attach)
+        command=""
+        for arg in "$@"; do
+            # escape single quotes
+            escaped=$(printf "%s" "$arg" | sed "s/'/'\\\\''/g")
+            command="$command '$escaped'"
+        done
+        printf '%s' "$command" > "$fifo"
+        read -r status < "$done"
+        exit "${status:-1}"
+        ;;
+    *)
+        echo "invalid action" >&2
+        exit 1
+        ;;
+esac
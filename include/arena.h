@@ -0,0 +1,24 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+struct xdptf_arena_chunk;
+
+// bump allocator for memory that lives exactly as long as a request;
+// nothing is freed on its own, xdptf_arena_reset releases it all at once
+struct xdptf_arena {
+    struct xdptf_arena_chunk *chunks;
+    // free space left in the current chunk
+    char *pos;
+    char *end;
+};
+
+// the returned memory is not zeroed
+void *xdptf_arena_alloc(struct xdptf_arena *arena, size_t size);
+char *xdptf_arena_strdup(struct xdptf_arena *arena, const char *s);
+char *xdptf_arena_printf(struct xdptf_arena *arena, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+void xdptf_arena_reset(struct xdptf_arena *arena);
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef CANONICAL_H
+#define CANONICAL_H
+
+#include "arena.h"
+#include <stddef.h>
+#include <stdint.h>
+
+struct canonical_entry {
+    // NULL for an empty slot
+    const char *key;
+    uint32_t len;
+    // upper half of the hash, the lower one picks the slot
+    uint32_t tag;
+};
+
+// open addressing with linear probing, kept at most half full
+struct canonical_table {
+    struct canonical_entry *entries;
+    size_t capacity;
+    size_t count;
+};
+
+// turns a chooser's paths into absolute ones without duplicates; everything
+// it hands out lives in arena
+struct canonical {
+    struct xdptf_arena *arena;
+    const char *home;
+    size_t home_len;
+    // what relative paths are relative to; NULL if they are not allowed
+    const char *base;
+    size_t base_len;
+    // every path handed out so far; keys point into the chooser output
+    // where that already had the path as it is
+    struct canonical_table seen;
+    char *expanded;
+    size_t expanded_size;
+};
+
+// base is the absolute directory relative paths are taken to be in, or NULL;
+// expected is the number of paths that are going to be added, if known
+int canonical_init(struct canonical *canonical, struct xdptf_arena *arena,
+                   const char *base, size_t expected);
+// expands ~ and relative paths and drops ., .. and repeated or trailing
+// slashes, all without going to the file system. Returns 1 and the result in
+// path, valid until the next call, if it has not been seen before, 0 if it
+// has, and -EINVAL for a relative path without a base. line has to stay
+// around as long as canonical is used.
+int canonical_add(struct canonical *canonical, const char *line, size_t len,
+                  const char **path, size_t *path_len);
+
+#endif
@@ -1,8 +1,11 @@
 #ifndef CONFIG_H
 #define CONFIG_H
 
+#include "launcher.h"
 #include "logger.h"
 
+#define DEFAULT_TERMCMD "kitty --title 'termfilechooser'"
+
 struct env_var {
     char *name;
     char *value;
@@ -14,7 +17,14 @@ struct environment {
     struct env_var *vars;
 };
 
-enum Mode { MODE_SUGGESTED_DIR, MODE_DEFAULT_DIR, MODE_LAST_DIR };
+enum Mode {
+    MODE_SUGGESTED_DIR,
+    MODE_DEFAULT_DIR,
+    MODE_LAST_DIR,
+    MODE_LAST_PER_APP
+};
+
+enum Channel { CHANNEL_FILE, CHANNEL_FIFO, CHANNEL_MEMFD };
 
 struct modes {
     enum Mode open_mode;
@@ -23,14 +33,46 @@ struct modes {
 
 struct config_filechooser {
     char *cmd;
+    // cmd split into words at load time, and argv[0] resolved against PATH
+    char **cmd_argv;
+    int cmd_argc;
+    char *cmd_path;
+    // used instead of cmd, unless cmd is configured
+    struct launcher_spec launcher;
     char *default_dir;
     char create_help_file;
+    enum Channel result_channel;
+    int pool_size;
+    int pool_idle_timeout;
+    char *pool_termcmd;
+    // seconds without a request after which the daemon exits, 0 for never
+    int idle_timeout;
+    // limits on a single reply, in selected paths and KiB of URIs
+    int max_selections;
+    int max_selection_size;
     struct modes *modes;
     struct environment *env;
+    // what choosers are spawned with: our environment with env applied
+    char **envp;
+    // held by the daemon while current, and by each request started with it
+    int refcount;
 };
 
 void print_config(enum LOGLEVEL loglevel, struct config_filechooser *config);
 void free_config(struct config_filechooser *config);
-void init_config(char **const configfile, struct config_filechooser *config);
+// config is filled in either way; returns whether the config file was found
+// and parsed without errors
+bool init_config(char **const configfile, struct config_filechooser *config);
+// for configs allocated with malloc; freed once the last reference is gone
+struct config_filechooser *config_ref(struct config_filechooser *config);
+void config_unref(struct config_filechooser *config);
+// where the config file is looked for if not given; returns how many
+// directories were stored in dirs, each to be freed
+int get_config_dirs(char *dirs[2]);
+char *shell_expand(const char *input);
+int split_words(const char *value, char ***argv, int *argc);
+char *find_executable(struct config_filechooser *config, const char *name);
+const char *resolve_cmd(struct config_filechooser *config);
+const char *get_config_env(struct config_filechooser *config, const char *name);
 
 #endif
@@ -0,0 +1,14 @@
+#ifndef EXPAND_H
+#define EXPAND_H
+
+#include <stddef.h>
+
+// expands ~, $VAR, ${VAR}, ${VAR-default} and ${VAR:-default} and removes
+// quotes like sh would, in one pass and without running anything. Words are
+// split at unquoted blanks only, expansions are never split further.
+// Returns the number of words, stored back to back and each NUL terminated in
+// *out, which is to be freed, and their size in *size. Returns -EINVAL for
+// values that would need a shell, like $(...), or do not parse.
+int expand_words(const char *value, char **out, size_t *size);
+
+#endif
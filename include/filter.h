@@ -0,0 +1,32 @@
+#ifndef FILTER_H
+#define FILTER_H
+
+#include "arena.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+struct filter_node;
+
+// glob patterns compiled into one matcher. The common *.ext kind goes into
+// a trie of reversed suffixes, so a name is checked against all of them in
+// a single walk from its end; anything else is left to fnmatch.
+// Everything lives in arena.
+struct filter {
+    struct xdptf_arena *arena;
+    struct filter_node *suffixes;
+    const char **globs;
+    size_t num_globs;
+    size_t globs_capacity;
+    // set by a pattern like * that every name matches
+    bool match_all;
+    size_t num_patterns;
+};
+
+void filter_init(struct filter *filter, struct xdptf_arena *arena);
+int filter_add(struct filter *filter, const char *pattern);
+// whether matching removes anything: there are patterns, but not *
+bool filter_active(const struct filter *filter);
+// path is NUL terminated, only its last component is matched
+bool filter_match(const struct filter *filter, const char *path, size_t len);
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef LAST_DIR_H
+#define LAST_DIR_H
+
+#include "mru.h"
+#include <stdbool.h>
+
+struct xdptf_state;
+
+// the directory last chosen from, for open_mode/save_mode=last. It is read
+// once at startup, and changes are written back with a delay, so requests
+// never touch the file. For last_per_app, the directory of each app is kept
+// in a file next to it.
+struct xdptf_last_dir {
+    // NULL if there is none yet
+    char *dir;
+    // $XDG_STATE_HOME/xdg-desktop-portal-termfilechooser and the file in it
+    char *state_dir;
+    char *path;
+    // dir changed since it was last written
+    bool dirty;
+    int timerfd;
+    // opened on the first per-app update if it does not exist yet
+    struct mru apps;
+    char *apps_path;
+};
+
+void xdptf_last_dir_init(struct xdptf_state *state);
+// with an app_id, the directory last chosen by that app if there is one
+const char *xdptf_last_dir_get(struct xdptf_state *state, const char *app_id);
+// app_id may be NULL to only update the directory shared by all apps
+void xdptf_last_dir_set(struct xdptf_state *state, const char *app_id,
+                        const char *dir);
+// writes out what is still pending
+void xdptf_last_dir_finish(struct xdptf_state *state);
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef LAUNCHER_H
+#define LAUNCHER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+enum LauncherMode {
+    LAUNCH_FILE,
+    LAUNCH_FILES,
+    LAUNCH_DIR,
+    LAUNCH_SAVE,
+    LAUNCH_NUM_MODES
+};
+
+// fix-ups applied to the selection once the file manager has exited
+enum LauncherPost {
+    POST_NONE,
+    // use the side file (%c) if the file manager left the result empty
+    POST_CWD_FILE,
+    // turn nnn's "cd '/dir'" into a plain path
+    POST_NNN_CD
+};
+
+// file manager invocation interpreted by the daemon itself, so no wrapper
+// script has to run in between. Template words may contain %p (suggested
+// path), %o (result path), %c (side file), %q (%p in double quotes) and %%.
+// Leading NAME=value words are set in the file manager's environment.
+struct launcher_spec {
+    char **argv[LAUNCH_NUM_MODES];
+    int argc[LAUNCH_NUM_MODES];
+    // run inside TERMCMD
+    char terminal;
+    enum LauncherPost post;
+};
+
+bool launcher_is_set(const struct launcher_spec *spec);
+int launcher_set_preset(struct launcher_spec *spec, const char *name);
+int launcher_set_post(struct launcher_spec *spec, const char *name);
+// takes ownership of argv
+void launcher_set_mode(struct launcher_spec *spec, enum LauncherMode mode,
+                       char **argv, int argc);
+void launcher_free(struct launcher_spec *spec);
+
+enum LauncherMode launcher_mode(bool writing, bool multiple, bool directory);
+bool launcher_uses_side_file(const struct launcher_spec *spec,
+                             enum LauncherMode mode);
+// returns a NULL terminated argv to run after prefix; free with
+// launcher_free_argv
+char **launcher_expand(const struct launcher_spec *spec,
+                       enum LauncherMode mode, char *const *prefix,
+                       int prefix_len, const char *path, const char *out,
+                       const char *side);
+void launcher_free_argv(char **argv);
+int launcher_post_process(const struct launcher_spec *spec, char **data,
+                          size_t *size, const char *side);
+
+#endif
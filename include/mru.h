@@ -0,0 +1,51 @@
+#ifndef MRU_H
+#define MRU_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// a slot is a cache line multiple, and the whole file 128 KiB
+#define MRU_NUM_SLOTS 128
+#define MRU_APP_ID_SIZE 128
+#define MRU_DIR_SIZE (1024 - 16 - MRU_APP_ID_SIZE)
+// slots an app_id may land in, the least recently used of them is evicted
+#define MRU_PROBE 8
+
+struct mru_slot {
+    // 0 for an empty slot
+    uint64_t hash;
+    uint64_t stamp;
+    char app_id[MRU_APP_ID_SIZE];
+    char dir[MRU_DIR_SIZE];
+};
+
+struct mru_file {
+    char magic[8];
+    uint32_t version;
+    uint32_t num_slots;
+    // bumped on every update, slots keep the value of their last one
+    uint64_t stamp;
+    char reserved[40];
+    struct mru_slot slots[MRU_NUM_SLOTS];
+};
+
+// the directory last chosen by each app. The file is read into memory once,
+// so lookups make no syscalls, and an update writes back only what it
+// changed. Nothing is mapped, so another process truncating the file cannot
+// crash the daemon.
+struct mru {
+    int fd;
+    struct mru_file *file;
+};
+
+// with create unset, fails with -ENOENT if there is no file yet
+int mru_open(struct mru *mru, const char *path, bool create);
+// NULL if app_id has no entry
+const char *mru_get(struct mru *mru, const char *app_id);
+// app ids too long for a slot are not stored; a directory too long for one
+// drops the app's entry, so lookups fall back to something else. Both fail
+// with -ENAMETOOLONG.
+int mru_set(struct mru *mru, const char *app_id, const char *dir);
+void mru_close(struct mru *mru);
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+struct xdptf_state;
+
+// pre-spawned terminal waiting for a chooser command on its fifo
+struct xdptf_pool_terminal {
+    pid_t pid;
+    // pidfd of the terminal, or a timerfd polling for it where there is none
+    int child_fd;
+    // command goes in through fifo, the exit code comes back on fifo.done
+    char *fifo;
+    char *done_fifo;
+    uint64_t spawn_usec;
+    bool busy;
+    // handed to a request, freed only once the request releases it
+    bool owned;
+    bool exited;
+    struct xdptf_pool_terminal *next;
+};
+
+struct xdptf_pool {
+    struct xdptf_pool_terminal *terminals;
+    int num_idle;
+    // read from the config once, a reload does not resize the pool
+    int size;
+    int idle_timeout;
+    int timerfd;
+    unsigned int serial;
+};
+
+void xdptf_pool_init(struct xdptf_state *state);
+void xdptf_pool_fill(struct xdptf_state *state);
+struct xdptf_pool_terminal *xdptf_pool_take(struct xdptf_state *state);
+void xdptf_pool_release(struct xdptf_state *state,
+                        struct xdptf_pool_terminal *terminal);
+void xdptf_pool_finish(struct xdptf_state *state);
+
+#endif
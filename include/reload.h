@@ -0,0 +1,24 @@
+#ifndef RELOAD_H
+#define RELOAD_H
+
+struct xdptf_state;
+
+// watches the config file, and the directories it is looked for in, so that
+// changes apply to the next request without a restart
+struct xdptf_reload {
+    int fd;
+    // as passed with --config, NULL if it is looked up
+    char *configfile;
+    // the file the current config was loaded from
+    char *path;
+    int file_wd;
+    char *dirs[2];
+    int num_dirs;
+};
+
+// takes ownership of configfile and path
+void xdptf_reload_init(struct xdptf_state *state, char *configfile,
+                       char *path);
+void xdptf_reload_finish(struct xdptf_state *state);
+
+#endif
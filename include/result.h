@@ -0,0 +1,32 @@
+#ifndef RESULT_H
+#define RESULT_H
+
+#include "config.h"
+#include <stddef.h>
+
+struct xdptf_state;
+
+// where a single request's chooser writes its selection
+struct xdptf_result {
+    enum Channel channel;
+    // handed to the wrapper as its 5th argument
+    char *path;
+    // memfd, or the read end of the fifo
+    int fd;
+    // fifo only: our own write end and what was drained from it so far
+    int wfd;
+    char *buf;
+    size_t len;
+    size_t capacity;
+    struct xdptf_state *state;
+};
+
+struct xdptf_result *xdptf_result_create(struct xdptf_state *state,
+                                         enum Channel channel,
+                                         const char *handle);
+// extra file for choosers with a second output, such as yazi's cwd file
+char *xdptf_result_create_side_file(const char *handle, const char *suffix);
+int xdptf_result_read(struct xdptf_result *result, char **data, size_t *size);
+void xdptf_result_destroy(struct xdptf_result *result);
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef SELECTION_H
+#define SELECTION_H
+
+#include "arena.h"
+#include "filter.h"
+#include <stddef.h>
+#include <sys/types.h>
+
+#define PATH_PREFIX "file://"
+
+// limits on what a selection may grow to; 0 means no limit
+struct selection_budget {
+    size_t max_count;
+    // bytes the URIs take up in a D-Bus string array
+    size_t max_size;
+};
+
+// what the paths have to point to; paths that do not exist or are of the
+// wrong type are dropped
+enum selection_type {
+    // anything, the paths are not looked up
+    SELECTION_ANY,
+    // anything but directories
+    SELECTION_FILES,
+    SELECTION_DIRS,
+};
+
+// what is left of a selection once its URIs have been handed on
+struct selection {
+    // the last URI, valid until the arena is reset
+    char *last;
+    // file type of the last path as in st_mode, 0 for SELECTION_ANY
+    mode_t last_type;
+    size_t count;
+    size_t size;
+};
+
+// gets each URI in turn; a negative return stops the parse and is passed on
+typedef int (*selection_handler)(void *data, size_t index, const char *uri);
+
+// turns the chooser output, one path per line, into file:// URIs of
+// canonical paths and hands them to handler without keeping them around;
+// relative paths are taken to be in base, the folder the chooser started in,
+// and dropped without one. Empty lines, duplicates and paths filter does not
+// match, if given, are skipped. Fails with -E2BIG as soon as the selection is
+// over budget.
+int selection_parse(struct xdptf_arena *arena, const char *data, size_t size,
+                    const char *base, const struct selection_budget *budget,
+                    enum selection_type type, const struct filter *filter,
+                    selection_handler handler, void *handler_data,
+                    struct selection *selection);
+
+#endif
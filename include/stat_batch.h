@@ -0,0 +1,11 @@
+#ifndef STAT_BATCH_H
+#define STAT_BATCH_H
+
+#include <stddef.h>
+
+// looks up the file type of each of paths, following symlinks; types[i]
+// gets the S_IFMT bits for paths[i] or a negative errno. The lookups are
+// done one by one on the calling thread.
+void stat_batch(const char *const *paths, size_t count, int *types);
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct xdptf_state;
+struct sd_bus_slot;
+
+enum xdptf_phase {
+    PHASE_DECODE,
+    PHASE_CURRENT_FOLDER,
+    PHASE_HELP_FILE,
+    PHASE_SPAWN,
+    PHASE_CHOOSER,
+    PHASE_PARSE,
+    PHASE_REPLY,
+    // method call to reply
+    PHASE_TOTAL,
+    PHASE_COUNT
+};
+
+// log-linear buckets: exact below 16us, then 8 per power of two
+#define STATS_NUM_BUCKETS 320
+
+struct xdptf_histogram {
+    uint64_t count;
+    uint64_t max_usec;
+    uint32_t buckets[STATS_NUM_BUCKETS];
+};
+
+struct xdptf_app_stats {
+    char *app_id;
+    uint64_t requests;
+    uint64_t failures;
+    struct xdptf_app_stats *next;
+};
+
+struct xdptf_stats {
+    struct xdptf_histogram phases[PHASE_COUNT];
+    struct xdptf_app_stats *apps;
+    int num_apps;
+    struct sd_bus_slot *slot;
+};
+
+uint64_t xdptf_now_usec(void);
+const char *xdptf_phase_name(enum xdptf_phase phase);
+
+int xdptf_stats_init(struct xdptf_state *state);
+void xdptf_stats_finish(struct xdptf_stats *stats);
+void xdptf_stats_record(struct xdptf_stats *stats, enum xdptf_phase phase,
+                        uint64_t usec);
+void xdptf_stats_record_request(struct xdptf_stats *stats, const char *app_id,
+                                bool failed);
+uint64_t xdptf_histogram_percentile(const struct xdptf_histogram *histogram,
+                                    double quantile);
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// spans are kept in a fixed ring, the oldest are dropped once it is full
+#define TRACE_MAX_EVENTS 65536
+#define TRACE_MAX_REQUESTS 4096
+
+// one complete span; tid 0 is the daemon itself
+struct xdptf_trace_event {
+    const char *name;
+    uint64_t start_usec;
+    uint64_t dur_usec;
+    uint32_t tid;
+    pid_t pid;
+};
+
+int xdptf_trace_init(const char *path);
+bool xdptf_trace_enabled(void);
+// returns the lane the spans of this request are recorded on
+uint32_t xdptf_trace_request(const char *handle, const char *app_id);
+void xdptf_trace_span(uint32_t tid, const char *name, uint64_t start_usec,
+                      uint64_t end_usec, pid_t pid);
+int xdptf_trace_flush(void);
+void xdptf_trace_finish(void);
+
+#endif
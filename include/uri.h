@@ -35,6 +35,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 // edited to exclude encoding/decoding the '/' character
 
 #include <inttypes.h>
+#include <stdbool.h>
 #include <stddef.h>
 
 #define _______ "\0\0\0\0"
@@ -80,5 +81,14 @@ static const unsigned char hexval[0x100] = {
 };
 #undef __
 
+// dst must hold 3 * len + 1 bytes for encoding and len + 1 for decoding
 size_t uri_encode(const char *src, const size_t len, char *dst);
+// same output as uri_encode; valid is cleared if src is not well-formed UTF-8
+size_t uri_encode_utf8(const char *src, const size_t len, char *dst,
+                       bool *valid);
 size_t uri_decode(const char *src, const size_t len, char *dst);
+
+// the kernel is picked from what the CPU supports on first use; setting it
+// by name ("avx2", "sse2" or "scalar") is for benchmarks and comparisons
+const char *uri_kernel(void);
+int uri_set_kernel(const char *name);
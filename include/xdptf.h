@@ -9,15 +9,91 @@
 #include <basu/sd-bus.h>
 #endif
 
+#include "arena.h"
 #include "config.h"
+#include "last_dir.h"
+#include "pool.h"
+#include "reload.h"
+#include "result.h"
+#include "stats.h"
+#include "trace.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+struct xdptf_state;
+
+typedef int (*xdptf_loop_handler)(struct xdptf_state *state, int fd,
+                                  short revents, void *data);
+
+// fd watched by the main loop next to the bus fd
+struct xdptf_watch {
+    int fd;
+    short events;
+    xdptf_loop_handler handler;
+    void *data;
+    struct xdptf_watch *next;
+};
+
+struct xdptf_request;
+
+// in-flight requests, keyed by request handle
+struct xdptf_registry {
+    struct xdptf_request **buckets;
+    size_t num_buckets;
+    size_t num_requests;
+    // closed requests whose chooser has yet to exit, linked through next
+    struct xdptf_request *cancelled;
+    // when the last request, closed or not, went away
+    uint64_t idle_since_usec;
+};
 
 struct xdptf_state {
     sd_bus *bus;
+    // the current config, swapped on reload
     struct config_filechooser *config;
+    struct xdptf_watch *watches;
+    struct xdptf_registry requests;
+    struct xdptf_pool pool;
+    struct xdptf_stats stats;
+    struct xdptf_reload reload;
+    struct xdptf_last_dir last_dir;
 };
 
+// called once the chooser spawned for a request has exited
+typedef void (*xdptf_request_exit_handler)(struct xdptf_request *req,
+                                           int status);
+
 struct xdptf_request {
     sd_bus_slot *slot;
+    char *handle;
+    // pending method call, replied to from on_exit
+    sd_bus_message *msg;
+    struct xdptf_state *state;
+    // the config as it was when the request came in
+    struct config_filechooser *config;
+    // chooser process, also the id of its process group
+    pid_t pid;
+    // pidfd of the chooser, or a timerfd polling for it where there is none
+    int child_fd;
+    struct xdptf_result *result;
+    // warm terminal the chooser was handed, if any
+    struct xdptf_pool_terminal *terminal;
+    char *app_id;
+    uint32_t trace_id;
+    // when the method call came in, and when the chooser was started
+    uint64_t start_usec;
+    uint64_t spawn_usec;
+    // set by Request.Close, the call has been answered already
+    bool cancelled;
+    xdptf_request_exit_handler on_exit;
+    void *data;
+    void (*free_data)(void *data);
+    // everything request-scoped, released with the request
+    struct xdptf_arena arena;
+    // next request in the same registry bucket, or in the cancelled list
+    struct xdptf_request *next;
+    bool registered;
 };
 
 enum {
@@ -28,7 +104,39 @@ enum {
 
 int xdptf_filechooser_init(struct xdptf_state *state);
 
-struct xdptf_request *xdptf_request_create(sd_bus *bus, const char *object_path);
+struct xdptf_request *xdptf_request_create(struct xdptf_state *state,
+                                           sd_bus_message *msg,
+                                           const char *object_path,
+                                           const char *app_id);
+struct xdptf_request *xdptf_request_lookup(struct xdptf_state *state,
+                                           const char *handle);
 void xdptf_request_destroy(struct xdptf_request *req);
+void xdptf_request_record(struct xdptf_request *req, enum xdptf_phase phase,
+                          uint64_t start_usec);
+void xdptf_request_cancel(struct xdptf_request *req);
+void xdptf_request_cancel_all(struct xdptf_state *state);
+// no requests left, not even closed ones waiting for their chooser
+bool xdptf_request_idle(const struct xdptf_state *state);
+int xdptf_request_spawn(struct xdptf_state *state, struct xdptf_request *req,
+                        const char *path, char *const argv[],
+                        char *const envp[],
+                        xdptf_request_exit_handler on_exit,
+                        uint64_t start_usec);
+int xdptf_spawn(const char *path, char *const argv[], char *const envp[],
+                pid_t *pid);
+int xdptf_spawn_shell(const char *cmd, char *const envp[], pid_t *pid);
+// watches pid from the loop, through a pidfd or else a timer polling for it;
+// handler is called with the returned fd and should xdptf_child_reap
+int xdptf_watch_child(struct xdptf_state *state, pid_t pid,
+                      xdptf_loop_handler handler, void *data);
+// 1 and the wait status, -1 if there is none, once pid has exited, and 0
+// while it runs
+int xdptf_child_reap(int fd, pid_t pid, int *status);
+
+int xdptf_loop_add(struct xdptf_state *state, int fd, short events,
+                   xdptf_loop_handler handler, void *data);
+void xdptf_loop_remove(struct xdptf_state *state, int fd);
+int xdptf_loop_wait(struct xdptf_state *state);
+void xdptf_loop_finish(struct xdptf_state *state);
 
 #endif
@@ -0,0 +1,104 @@
+#include "arena.h"
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// a page, header included; a request rarely needs more than one
+#define CHUNK_SIZE 4096
+
+struct xdptf_arena_chunk {
+    struct xdptf_arena_chunk *next;
+    max_align_t data[];
+};
+
+static size_t align_up(size_t size)
+{
+    const size_t align = _Alignof(max_align_t);
+    return (size + align - 1) & ~(align - 1);
+}
+
+void *xdptf_arena_alloc(struct xdptf_arena *arena, size_t size)
+{
+    size = align_up(size ? size : 1);
+    if (size <= (size_t)(arena->end - arena->pos)) {
+        void *ptr = arena->pos;
+        arena->pos += size;
+        return ptr;
+    }
+
+    const size_t header = sizeof(struct xdptf_arena_chunk);
+    if (size > SIZE_MAX - header) {
+        return NULL;
+    }
+
+    // anything over a quarter chunk gets a chunk of its own, which goes
+    // behind the current one so its free space is not thrown away
+    if (size > (CHUNK_SIZE - header) / 4) {
+        struct xdptf_arena_chunk *chunk = malloc(header + size);
+        if (chunk == NULL) {
+            return NULL;
+        }
+        if (arena->chunks) {
+            chunk->next = arena->chunks->next;
+            arena->chunks->next = chunk;
+        } else {
+            chunk->next = NULL;
+            arena->chunks = chunk;
+        }
+        return chunk->data;
+    }
+
+    struct xdptf_arena_chunk *chunk = malloc(CHUNK_SIZE);
+    if (chunk == NULL) {
+        return NULL;
+    }
+    chunk->next = arena->chunks;
+    arena->chunks = chunk;
+    arena->pos = (char *)chunk->data + size;
+    arena->end = (char *)chunk + CHUNK_SIZE;
+    return chunk->data;
+}
+
+char *xdptf_arena_strdup(struct xdptf_arena *arena, const char *s)
+{
+    size_t size = 1 + strlen(s);
+    char *copy = xdptf_arena_alloc(arena, size);
+    if (copy) {
+        memcpy(copy, s, size);
+    }
+    return copy;
+}
+
+char *xdptf_arena_printf(struct xdptf_arena *arena, const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(NULL, 0, fmt, args);
+    va_end(args);
+    if (len < 0) {
+        return NULL;
+    }
+
+    char *str = xdptf_arena_alloc(arena, 1 + len);
+    if (str) {
+        va_start(args, fmt);
+        vsnprintf(str, 1 + len, fmt, args);
+        va_end(args);
+    }
+    return str;
+}
+
+void xdptf_arena_reset(struct xdptf_arena *arena)
+{
+    struct xdptf_arena_chunk *chunk = arena->chunks;
+    while (chunk) {
+        struct xdptf_arena_chunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    arena->chunks = NULL;
+    arena->pos = NULL;
+    arena->end = NULL;
+}
@@ -1,48 +1,51 @@
 #include "config.h"
+#include "expand.h"
 #include "logger.h"
 #include <ctype.h>
+#include <errno.h>
 #include <ini.h>
+#include <limits.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <sys/stat.h>
 #include <unistd.h>
-#include <wordexp.h>
 
-static char *shell_expand(const char *input)
+extern char **environ;
+
+char *shell_expand(const char *input)
 {
-    wordexp_t p;
-    if (wordexp(input, &p, 0) != 0) {
-        // return original if expansion fails
+    char *expanded;
+    size_t size;
+    int words = expand_words(input, &expanded, &size);
+    if (words < 0) {
+        logprint(WARN, "config: could not expand '%s', using it as is",
+                 input);
         return strdup(input);
     }
-
-    size_t expanded_size = 0;
-    for (size_t i = 0; i < p.we_wordc; i++) {
-        expanded_size += 1 + strlen(p.we_wordv[i]);
-    }
-
-    if (!expanded_size) {
+    if (words == 0) {
+        free(expanded);
         return strdup(input);
     }
 
-    char *expanded = malloc(expanded_size);
-
-    // null beginning
-    expanded[0] = '\0';
-    for (size_t i = 0; i < p.we_wordc; i++) {
-        if (i > 0)
-            strcat(expanded, " ");
-        strcat(expanded, p.we_wordv[i]);
+    // join the words with single spaces
+    for (size_t i = 0; i + 1 < size; i++) {
+        if (expanded[i] == '\0') {
+            expanded[i] = ' ';
+        }
     }
-
-    wordfree(&p);
     return expanded;
 }
 
 void print_config(enum LOGLEVEL loglevel, struct config_filechooser *config)
 {
-    logprint(loglevel, "config: cmd:  %s", config->cmd);
+    if (config->cmd) {
+        logprint(loglevel, "config: cmd:  %s", config->cmd);
+    } else if (launcher_is_set(&config->launcher)) {
+        logprint(loglevel, "config: cmd:  none, using the launcher");
+    }
     logprint(loglevel, "config: default_dir:  %s", config->default_dir);
     for (int i = 0; i < config->env->num_vars; i++) {
         logprint(loglevel, "config: env:  %s=%s", config->env->vars[i].name,
@@ -50,14 +53,30 @@ void print_config(enum LOGLEVEL loglevel, struct config_filechooser *config)
     }
 }
 
+static void clear_cmd(struct config_filechooser *config)
+{
+    for (int i = 0; i < config->cmd_argc; i++) {
+        free(config->cmd_argv[i]);
+    }
+    free(config->cmd_argv);
+    free(config->cmd);
+    free(config->cmd_path);
+    config->cmd_argv = NULL;
+    config->cmd_argc = 0;
+    config->cmd = NULL;
+    config->cmd_path = NULL;
+}
+
 // NOTE: calling free_config won't prepare the config to be read again from
 // config file with init_config since to pointers and other values won't be
 // reset to NULL, or 0
 void free_config(struct config_filechooser *config)
 {
     logprint(DEBUG, "config: freeing config");
-    free(config->cmd);
+    clear_cmd(config);
+    launcher_free(&config->launcher);
     free(config->default_dir);
+    free(config->pool_termcmd);
     free(config->modes);
     for (int i = 0; i < config->env->num_vars; i++) {
         free(config->env->vars[i].name);
@@ -65,6 +84,21 @@ void free_config(struct config_filechooser *config)
     }
     free(config->env->vars);
     free(config->env);
+    free(config->envp);
+}
+
+struct config_filechooser *config_ref(struct config_filechooser *config)
+{
+    config->refcount++;
+    return config;
+}
+
+void config_unref(struct config_filechooser *config)
+{
+    if (config && --config->refcount == 0) {
+        free_config(config);
+        free(config);
+    }
 }
 
 static void parse_string(char **dest, const char *value)
@@ -101,6 +135,23 @@ static void parse_bool(char *dest, const char *strval)
     }
 }
 
+static void parse_int(int *dest, const char *strval)
+{
+    if (strval == NULL || *strval == '\0') {
+        logprint(DEBUG, "config: skipping empty value in config file");
+        return;
+    }
+
+    char *end = NULL;
+    errno = 0;
+    long value = strtol(strval, &end, 10);
+    if (errno || *end != '\0' || value < 0 || value > INT_MAX) {
+        logprint(DEBUG, "config: unknown integer in config file");
+        return;
+    }
+    *dest = value;
+}
+
 static void parse_modes(enum Mode *mode, const char *modestr)
 {
     if (modestr == NULL || *modestr == '\0') {
@@ -122,6 +173,8 @@ static void parse_modes(enum Mode *mode, const char *modestr)
         *mode = MODE_DEFAULT_DIR;
     } else if (strcmp(value, "last") == 0) {
         *mode = MODE_LAST_DIR;
+    } else if (strcmp(value, "last_per_app") == 0) {
+        *mode = MODE_LAST_PER_APP;
     } else {
         logprint(DEBUG, "config: skipping unknown mode in config file");
     }
@@ -129,6 +182,50 @@ static void parse_modes(enum Mode *mode, const char *modestr)
     free(value);
 }
 
+static void parse_channel(enum Channel *channel, const char *channelstr)
+{
+    if (channelstr == NULL || *channelstr == '\0') {
+        logprint(DEBUG, "config: skipping empty result_channel in config file");
+        return;
+    }
+
+    char *value = strdup(channelstr);
+
+    char *ptr = value;
+    while (*ptr) {
+        *ptr = tolower(*ptr);
+        ptr++;
+    }
+
+    if (strcmp(value, "file") == 0) {
+        *channel = CHANNEL_FILE;
+    } else if (strcmp(value, "fifo") == 0) {
+        *channel = CHANNEL_FIFO;
+    } else if (strcmp(value, "memfd") == 0) {
+        *channel = CHANNEL_MEMFD;
+    } else {
+        logprint(DEBUG,
+                 "config: skipping unknown result_channel in config file");
+    }
+
+    free(value);
+}
+
+// takes ownership of name and value
+static void add_env(struct environment *env, char *name, char *value)
+{
+    // dynamically allocate more vars
+    if (env->num_vars == env->capacity) {
+        env->capacity += 5;
+        env->vars = realloc(env->vars, sizeof(struct env_var) * env->capacity);
+    }
+
+    // append to env
+    env->vars[env->num_vars].name = name;
+    env->vars[env->num_vars].value = value;
+    env->num_vars++;
+}
+
 static void parse_env(struct environment *env, const char *envstr)
 {
     if (envstr == NULL || *envstr == '\0') {
@@ -142,28 +239,163 @@ static void parse_env(struct environment *env, const char *envstr)
         return;
     }
 
-    char *name = strndup(envstr, sep - envstr);
     char *value = strdup(sep + 1);
     char *expanded = shell_expand(value);
     free(value);
 
-    // dynamically allocate more vars
-    if (env->num_vars == env->capacity) {
-        env->capacity += 5;
-        env->vars = realloc(env->vars, sizeof(struct env_var) * env->capacity);
+    add_env(env, strndup(envstr, sep - envstr), expanded);
+}
+
+// splits value into shell words without running a shell; argv is NULL
+// terminated
+int split_words(const char *value, char ***argv, int *argc)
+{
+    char *words;
+    size_t size;
+    int num_words = expand_words(value, &words, &size);
+    if (num_words <= 0) {
+        if (num_words == 0) {
+            free(words);
+        }
+        return -1;
     }
 
-    // append to env
-    env->vars[env->num_vars].name = name;
-    env->vars[env->num_vars].value = expanded;
-    env->num_vars++;
+    *argc = num_words;
+    *argv = malloc((num_words + 1) * sizeof(char *));
+    const char *word = words;
+    for (int i = 0; i < num_words; i++) {
+        (*argv)[i] = strdup(word);
+        word += strlen(word) + 1;
+    }
+    (*argv)[num_words] = NULL;
+    free(words);
+    return 0;
+}
+
+static bool is_assignment(const char *word)
+{
+    const char *ptr = word;
+    while (isalnum((unsigned char)*ptr) || *ptr == '_') {
+        ptr++;
+    }
+    return ptr != word && *ptr == '=';
+}
+
+// split cmd into words once at load time, so requests can spawn it without a
+// shell. Leading NAME=value words are taken as env entries, like sh would.
+static void parse_cmd(struct config_filechooser *config, const char *value)
+{
+    if (value == NULL || *value == '\0') {
+        logprint(DEBUG, "config: skipping empty value in config file");
+        return;
+    }
+
+    char **words;
+    int num_words;
+    if (split_words(value, &words, &num_words) < 0) {
+        logprint(ERROR, "config: could not parse cmd '%s'", value);
+        return;
+    }
+
+    int first = 0;
+    while (first < num_words - 1 && is_assignment(words[first])) {
+        // already expanded by split_words
+        char *sep = strchr(words[first], '=');
+        add_env(config->env, strndup(words[first], sep - words[first]),
+                strdup(sep + 1));
+        free(words[first]);
+        first++;
+    }
+
+    // cmd and launcher exclude each other, the last one set wins
+    clear_cmd(config);
+    launcher_free(&config->launcher);
+
+    config->cmd_argc = num_words - first;
+    config->cmd_argv = malloc(config->cmd_argc * sizeof(char *));
+    memcpy(config->cmd_argv, words + first, config->cmd_argc * sizeof(char *));
+    free(words);
+
+    // joined back, for logging only
+    size_t cmd_size = 1;
+    for (int i = 0; i < config->cmd_argc; i++) {
+        cmd_size += 1 + strlen(config->cmd_argv[i]);
+    }
+    config->cmd = malloc(cmd_size);
+    config->cmd[0] = '\0';
+    for (int i = 0; i < config->cmd_argc; i++) {
+        if (i > 0)
+            strcat(config->cmd, " ");
+        strcat(config->cmd, config->cmd_argv[i]);
+    }
+}
+
+static const char *const launcher_mode_keys[LAUNCH_NUM_MODES] = {
+    [LAUNCH_FILE] = "launcher_file",
+    [LAUNCH_FILES] = "launcher_files",
+    [LAUNCH_DIR] = "launcher_dir",
+    [LAUNCH_SAVE] = "launcher_save",
+};
+
+// the mode key sets the command for, or -1
+static int launcher_mode_key(const char *key)
+{
+    for (int mode = 0; mode < LAUNCH_NUM_MODES; mode++) {
+        if (strcmp(key, launcher_mode_keys[mode]) == 0) {
+            return mode;
+        }
+    }
+    return -1;
+}
+
+static bool is_launcher_key(const char *key)
+{
+    return strcmp(key, "launcher") == 0 || strcmp(key, "launcher_post") == 0 ||
+           strcmp(key, "launcher_terminal") == 0 ||
+           launcher_mode_key(key) >= 0;
+}
+
+static void parse_launcher(struct config_filechooser *config, const char *key,
+                           const char *value)
+{
+    if (value == NULL || *value == '\0') {
+        logprint(DEBUG, "config: skipping empty value in config file");
+        return;
+    }
+
+    struct launcher_spec *spec = &config->launcher;
+    // only the keys that set a command replace cmd
+    int ret = 0;
+    if (strcmp(key, "launcher_post") == 0) {
+        ret = launcher_set_post(spec, value);
+    } else if (strcmp(key, "launcher_terminal") == 0) {
+        parse_bool(&spec->terminal, value);
+    } else if (strcmp(key, "launcher") == 0) {
+        ret = launcher_set_preset(spec, value);
+        if (ret == 0) {
+            clear_cmd(config);
+        }
+    } else {
+        char **argv;
+        int argc;
+        ret = split_words(value, &argv, &argc);
+        if (ret == 0) {
+            launcher_set_mode(spec, launcher_mode_key(key), argv, argc);
+            clear_cmd(config);
+        }
+    }
+
+    if (ret < 0) {
+        logprint(WARN, "config: skipping invalid %s '%s' in config file", key,
+                 value);
+    }
 }
 
 static int handle_ini_filechooser(struct config_filechooser *filechooser_conf,
                                   const char *key, const char *value)
 {
     if (strcmp(key, "cmd") == 0) {
-        parse_string(&filechooser_conf->cmd, value);
+        parse_cmd(filechooser_conf, value);
     } else if (strcmp(key, "default_dir") == 0) {
         parse_string(&filechooser_conf->default_dir, value);
     } else if (strcmp(key, "create_help_file") == 0) {
@@ -172,10 +404,26 @@ static int handle_ini_filechooser(struct config_filechooser *filechooser_conf,
         parse_modes(&filechooser_conf->modes->open_mode, value);
     } else if (strcmp(key, "save_mode") == 0) {
         parse_modes(&filechooser_conf->modes->save_mode, value);
+    } else if (strcmp(key, "pool_size") == 0) {
+        parse_int(&filechooser_conf->pool_size, value);
+    } else if (strcmp(key, "pool_idle_timeout") == 0) {
+        parse_int(&filechooser_conf->pool_idle_timeout, value);
+    } else if (strcmp(key, "pool_termcmd") == 0) {
+        parse_string(&filechooser_conf->pool_termcmd, value);
+    } else if (strcmp(key, "idle_timeout") == 0) {
+        parse_int(&filechooser_conf->idle_timeout, value);
+    } else if (strcmp(key, "max_selections") == 0) {
+        parse_int(&filechooser_conf->max_selections, value);
+    } else if (strcmp(key, "max_selection_size") == 0) {
+        parse_int(&filechooser_conf->max_selection_size, value);
+    } else if (strcmp(key, "result_channel") == 0) {
+        parse_channel(&filechooser_conf->result_channel, value);
     } else if (strcmp(key, "env") == 0) {
         parse_env(filechooser_conf->env, value);
+    } else if (is_launcher_key(key)) {
+        parse_launcher(filechooser_conf, key, value);
     } else {
-        logprint(WARN, "config: skipping invalid key in config file");
+        logprint(WARN, "config: skipping invalid key %s in config file", key);
         return 0;
     }
     return 1;
@@ -207,7 +455,7 @@ static void set_default_config(struct config_filechooser *config)
         DATADIR "/xdg-desktop-portal-termfilechooser/yazi-wrapper.sh";
     if (access(default_cmd, F_OK) == 0 &&
         access(default_cmd, R_OK | X_OK) == 0) {
-        config->cmd = strdup(default_cmd);
+        parse_cmd(config, default_cmd);
     } else {
         logprint(WARN, "config: default cmd '%s' is not executable",
                  default_cmd);
@@ -222,7 +470,15 @@ static void set_default_config(struct config_filechooser *config)
     default_modes->save_mode = MODE_SUGGESTED_DIR;
     config->modes = default_modes;
 
+    config->refcount = 1;
     config->create_help_file = 1;
+    config->result_channel = CHANNEL_FILE;
+    config->pool_size = 0;
+    config->pool_idle_timeout = 300;
+    config->idle_timeout = 0;
+    // half of what D-Bus allows for a single array
+    config->max_selections = 0;
+    config->max_selection_size = 32 * 1024;
 
     struct environment *env = malloc(sizeof(struct environment));
     env->num_vars = 0;
@@ -231,33 +487,59 @@ static void set_default_config(struct config_filechooser *config)
     config->env = env;
 }
 
+static const char config_folder[] = "xdg-desktop-portal-termfilechooser";
+
 static char *build_config_path(const char *base, const char *filename)
 {
     if (!base || !base[0] || !filename || !filename[0]) {
         return NULL;
     }
 
-    const char *config_folder = "xdg-desktop-portal-termfilechooser";
     size_t size = 3 + strlen(base) + strlen(config_folder) + strlen(filename);
     char *path = malloc(size);
     snprintf(path, size, "%s/%s/%s", base, config_folder, filename);
     return path;
 }
 
-static char *get_config_path(void)
+// $XDG_CONFIG_HOME, or its default
+static char *get_config_home(void)
 {
+    const char *config_home = getenv("XDG_CONFIG_HOME");
+    if (config_home && config_home[0]) {
+        return strdup(config_home);
+    }
+
     const char *home = getenv("HOME");
-    char *config_home_fallback = NULL;
-    if (home && home[0]) {
-        size_t size_fallback = 1 + strlen(home) + strlen("/.config");
-        config_home_fallback = malloc(size_fallback);
-        snprintf(config_home_fallback, size_fallback, "%s/.config", home);
+    if (!home || !home[0]) {
+        return NULL;
     }
+    size_t size = 1 + strlen(home) + strlen("/.config");
+    char *fallback = malloc(size);
+    snprintf(fallback, size, "%s/.config", home);
+    return fallback;
+}
 
-    const char *config_home = getenv("XDG_CONFIG_HOME");
-    if (!config_home || !config_home[0]) {
-        config_home = config_home_fallback;
+int get_config_dirs(char *dirs[2])
+{
+    char *config_home = get_config_home();
+    const char *prefixes[] = {config_home, SYSCONFDIR "/xdg"};
+    int num_dirs = 0;
+    for (size_t i = 0; i < 2; i++) {
+        if (!prefixes[i]) {
+            continue;
+        }
+        size_t size = 2 + strlen(prefixes[i]) + strlen(config_folder);
+        dirs[num_dirs] = malloc(size);
+        snprintf(dirs[num_dirs], size, "%s/%s", prefixes[i], config_folder);
+        num_dirs++;
     }
+    free(config_home);
+    return num_dirs;
+}
+
+static char *get_config_path(void)
+{
+    char *config_home = get_config_home();
 
     const char *prefixes[] = {config_home, SYSCONFDIR "/xdg"};
     const char *xdg_current_desktop = getenv("XDG_CURRENT_DESKTOP");
@@ -271,7 +553,7 @@ static char *get_config_path(void)
                 char *path = build_config_path(prefixes[i], config);
                 logprint(TRACE, "config: trying config file %s", path);
                 if (path && file_exists(path)) {
-                    free(config_home_fallback);
+                    free(config_home);
                     free(config_list);
                     return path;
                 }
@@ -284,13 +566,13 @@ static char *get_config_path(void)
         char *path = build_config_path(prefixes[i], config_fallback);
         logprint(TRACE, "config: trying config file %s", path);
         if (path && file_exists(path)) {
-            free(config_home_fallback);
+            free(config_home);
             return path;
         }
         free(path);
     }
 
-    free(config_home_fallback);
+    free(config_home);
     return NULL;
 }
 
@@ -329,7 +611,147 @@ static void init_wrapper_path(struct environment *env,
     free(path_env);
 }
 
-void init_config(char **const configfile, struct config_filechooser *config)
+static bool is_executable(const char *path)
+{
+    struct stat st;
+    return stat(path, &st) == 0 && S_ISREG(st.st_mode) &&
+           access(path, X_OK) == 0;
+}
+
+// looks name up in the configured PATH, like execvp would
+char *find_executable(struct config_filechooser *config, const char *name)
+{
+    if (strchr(name, '/')) {
+        return is_executable(name) ? strdup(name) : NULL;
+    }
+
+    const char *path_env = get_config_env(config, "PATH");
+    char *paths = strdup(path_env ? path_env : "");
+    char *found = NULL;
+    char *saveptr = NULL;
+    for (char *dir = strtok_r(paths, ":", &saveptr); dir;
+         dir = strtok_r(NULL, ":", &saveptr)) {
+        size_t size = 2 + strlen(dir) + strlen(name);
+        char *candidate = malloc(size);
+        snprintf(candidate, size, "%s/%s", dir, name);
+        if (is_executable(candidate)) {
+            found = candidate;
+            break;
+        }
+        free(candidate);
+    }
+    free(paths);
+    return found;
+}
+
+// returns the absolute path of the cmd executable; the lookup is cached and
+// only redone if the cached file goes away
+const char *resolve_cmd(struct config_filechooser *config)
+{
+    if (config->cmd_argc == 0) {
+        return NULL;
+    }
+
+    if (config->cmd_path && access(config->cmd_path, X_OK) == 0) {
+        return config->cmd_path;
+    }
+    free(config->cmd_path);
+    config->cmd_path = find_executable(config, config->cmd_argv[0]);
+
+    if (config->cmd_path) {
+        logprint(DEBUG, "config: resolved cmd to '%s'", config->cmd_path);
+    } else {
+        logprint(ERROR, "config: cmd '%s' not found", config->cmd_argv[0]);
+    }
+    return config->cmd_path;
+}
+
+static uint64_t hash_name(const char *name, size_t len)
+{
+    uint64_t hash = 0xcbf29ce484222325;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)name[i];
+        hash *= 0x100000001b3;
+    }
+    return hash;
+}
+
+// the slot holding the NUL terminated name, or the empty one it would go into
+static const char **find_name(const char **names, size_t mask,
+                              const char *name, size_t len)
+{
+    for (size_t i = hash_name(name, len) & mask;; i = (i + 1) & mask) {
+        if (names[i] == NULL ||
+            (strncmp(names[i], name, len) == 0 && names[i][len] == '\0')) {
+            return &names[i];
+        }
+    }
+}
+
+static size_t entry_name_len(const char *entry)
+{
+    const char *sep = strchr(entry, '=');
+    return sep ? (size_t)(sep - entry) : strlen(entry);
+}
+
+// our environment with env on top, in a single allocation; built once per
+// config, so spawning a chooser never touches environ
+static char **build_envp(struct environment *env)
+{
+    size_t capacity = 16;
+    while (capacity < 2 * (size_t)env->num_vars) {
+        capacity *= 2;
+    }
+    const char **names = calloc(capacity, sizeof(char *));
+    bool *keep = malloc(env->num_vars + 1);
+
+    // later declarations win, like they do when applied in order
+    size_t count = 0, size = 0;
+    for (int i = env->num_vars - 1; i >= 0; i--) {
+        const char *name = env->vars[i].name;
+        const char **slot =
+            find_name(names, capacity - 1, name, strlen(name));
+        keep[i] = *slot == NULL;
+        if (keep[i]) {
+            *slot = name;
+            count++;
+            size += strlen(name) + strlen(env->vars[i].value) + 2;
+        }
+    }
+    for (char **entry = environ; *entry; entry++) {
+        if (*find_name(names, capacity - 1, *entry,
+                       entry_name_len(*entry)) == NULL) {
+            count++;
+            size += strlen(*entry) + 1;
+        }
+    }
+
+    char **envp = malloc((count + 1) * sizeof(char *) + size);
+    char *pos = (char *)(envp + count + 1);
+    size_t n = 0;
+    for (char **entry = environ; *entry; entry++) {
+        if (*find_name(names, capacity - 1, *entry,
+                       entry_name_len(*entry)) == NULL) {
+            envp[n++] = pos;
+            pos = stpcpy(pos, *entry) + 1;
+        }
+    }
+    for (int i = 0; i < env->num_vars; i++) {
+        if (keep[i]) {
+            envp[n++] = pos;
+            pos += sprintf(pos, "%s=%s", env->vars[i].name,
+                           env->vars[i].value) +
+                   1;
+        }
+    }
+    envp[n] = NULL;
+
+    free(names);
+    free(keep);
+    return envp;
+}
+
+bool init_config(char **const configfile, struct config_filechooser *config)
 {
     if (!*configfile)
         *configfile = get_config_path();
@@ -337,12 +759,37 @@ void init_config(char **const configfile, struct config_filechooser *config)
     set_default_config(config);
     init_wrapper_path(config->env, *configfile);
 
+    bool loaded = false;
     if (!*configfile) {
         logprint(ERROR, "config: no config file found, using the default");
-        return;
+    } else {
+        int ret = ini_parse(*configfile, handle_ini_config, config);
+        if (ret < 0) {
+            logprint(ERROR, "config: unable to load config file '%s'",
+                     *configfile);
+        } else if (ret > 0) {
+            logprint(ERROR, "config: error in config file '%s' on line %d",
+                     *configfile, ret);
+        } else {
+            loaded = true;
+        }
     }
 
-    if (ini_parse(*configfile, handle_ini_config, config) < 0) {
-        logprint(ERROR, "config: unable to load config file '%s'", *configfile);
+    if (config->cmd_argc > 0) {
+        resolve_cmd(config);
     }
+    config->envp = build_envp(config->env);
+    return loaded;
 }
+
+const char *get_config_env(struct config_filechooser *config, const char *name)
+{
+    // later declarations win, like they do when applied in order
+    for (int i = config->env->num_vars - 1; i >= 0; i--) {
+        if (strcmp(config->env->vars[i].name, name) == 0) {
+            return config->env->vars[i].value;
+        }
+    }
+    return getenv(name);
+}
+
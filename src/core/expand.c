@@ -0,0 +1,272 @@
+#include "expand.h"
+#include <ctype.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef WITH_WORDEXP
+#include <wordexp.h>
+
+// opted into at build time: full sh word expansion, including command
+// substitution run by a shell
+int expand_words(const char *value, char **out, size_t *size)
+{
+    wordexp_t p;
+    if (wordexp(value, &p, 0) != 0) {
+        return -EINVAL;
+    }
+
+    size_t len = 0;
+    for (size_t i = 0; i < p.we_wordc; i++) {
+        len += strlen(p.we_wordv[i]) + 1;
+    }
+    char *buf = malloc(len + 1);
+    if (buf == NULL) {
+        wordfree(&p);
+        return -ENOMEM;
+    }
+    len = 0;
+    for (size_t i = 0; i < p.we_wordc; i++) {
+        size_t word_len = strlen(p.we_wordv[i]) + 1;
+        memcpy(buf + len, p.we_wordv[i], word_len);
+        len += word_len;
+    }
+
+    int words = p.we_wordc;
+    wordfree(&p);
+    *out = buf;
+    *size = len;
+    return words;
+}
+
+#else
+
+extern char **environ;
+
+// what ends a run of characters that are copied as they are
+#define SPECIAL " \t'\"\\$~`|&;<>(){}\n"
+#define SPECIAL_QUOTED "\"\\$`"
+
+struct expander {
+    const char *pos;
+    char *buf;
+    size_t len;
+    size_t size;
+    int words;
+    // the current word has begun, which "" does without adding to it
+    bool in_word;
+};
+
+static int put(struct expander *e, const char *s, size_t n)
+{
+    // keeps room for the NUL that ends the word
+    if (e->len + n + 1 > e->size) {
+        size_t size = e->size;
+        while (size < e->len + n + 1) {
+            size *= 2;
+        }
+        char *buf = realloc(e->buf, size);
+        if (buf == NULL) {
+            return -ENOMEM;
+        }
+        e->buf = buf;
+        e->size = size;
+    }
+    memcpy(e->buf + e->len, s, n);
+    e->len += n;
+    e->in_word = true;
+    return 0;
+}
+
+static void end_word(struct expander *e)
+{
+    if (e->in_word) {
+        e->buf[e->len++] = '\0';
+        e->words++;
+        e->in_word = false;
+    }
+}
+
+// getenv for a name that is not NUL terminated
+static const char *lookup(const char *name, size_t len)
+{
+    for (char **var = environ; *var; var++) {
+        if (strncmp(*var, name, len) == 0 && (*var)[len] == '=') {
+            return *var + len + 1;
+        }
+    }
+    return NULL;
+}
+
+static size_t name_len(const char *s)
+{
+    if (!isalpha((unsigned char)*s) && *s != '_') {
+        return 0;
+    }
+    size_t len = 1;
+    while (isalnum((unsigned char)s[len]) || s[len] == '_') {
+        len++;
+    }
+    return len;
+}
+
+static int expand_until(struct expander *e, bool nested);
+
+// pos is on the $
+static int expand_param(struct expander *e)
+{
+    const char *p = e->pos + 1;
+    bool braced = *p == '{';
+    if (braced) {
+        p++;
+    }
+    size_t len = name_len(p);
+    if (len == 0) {
+        // $(...), $((...)) and ${#...} need a shell
+        if (braced || *p == '(') {
+            return -EINVAL;
+        }
+        e->pos++;
+        return put(e, "$", 1);
+    }
+
+    const char *value = lookup(p, len);
+    p += len;
+    if (braced && *p != '}') {
+        bool colon = *p == ':';
+        if (colon) {
+            p++;
+        }
+        if (*p != '-') {
+            return -EINVAL;
+        }
+        // the default is parsed either way, and dropped again if not used
+        size_t saved_len = e->len;
+        bool saved_in_word = e->in_word;
+        e->pos = p + 1;
+        int ret = expand_until(e, true);
+        if (ret < 0 || value == NULL || (colon && *value == '\0')) {
+            return ret;
+        }
+        e->len = saved_len;
+        e->in_word = saved_in_word;
+    } else {
+        e->pos = p + braced;
+    }
+
+    if (value && *value) {
+        return put(e, value, strlen(value));
+    }
+    return 0;
+}
+
+// pos is on a ~ that starts a word
+static int expand_tilde(struct expander *e, bool nested)
+{
+    char next = *++e->pos;
+    bool alone = next == '\0' || next == '/' ||
+                 (nested ? next == '}' : next == ' ' || next == '\t');
+    const char *home = getenv("HOME");
+    // ~user is left as it is
+    if (!alone || home == NULL) {
+        return put(e, "~", 1);
+    }
+    return put(e, home, strlen(home));
+}
+
+// expands up to the end of the value, or up to and including the closing }
+// of a ${VAR:-default} when nested, where blanks do not split words
+static int expand_until(struct expander *e, bool nested)
+{
+    bool quoted = false;
+    bool word_start = true;
+    for (;;) {
+        const char *p = e->pos;
+        bool at_start = word_start;
+        word_start = false;
+        int ret = 0;
+
+        if (*p == '\0') {
+            return quoted || nested ? -EINVAL : 0;
+        } else if (quoted) {
+            if (*p == '"') {
+                quoted = false;
+                e->pos++;
+            } else if (*p == '\\' && p[1] && strchr("$`\"\\", p[1])) {
+                ret = put(e, p + 1, 1);
+                e->pos += 2;
+            } else if (*p == '$') {
+                ret = expand_param(e);
+            } else if (*p == '`') {
+                return -EINVAL;
+            } else {
+                size_t n = 1 + strcspn(p + 1, SPECIAL_QUOTED);
+                ret = put(e, p, n);
+                e->pos += n;
+            }
+        } else if (*p == '}' && nested) {
+            e->pos++;
+            return 0;
+        } else if ((*p == ' ' || *p == '\t') && !nested) {
+            end_word(e);
+            e->pos++;
+            word_start = true;
+        } else if (*p == '~' && at_start) {
+            ret = expand_tilde(e, nested);
+        } else if (*p == '\'') {
+            const char *end = strchr(p + 1, '\'');
+            if (end == NULL) {
+                return -EINVAL;
+            }
+            ret = put(e, p + 1, end - p - 1);
+            e->pos = end + 1;
+        } else if (*p == '"') {
+            ret = put(e, "", 0);
+            quoted = true;
+            e->pos++;
+        } else if (*p == '\\') {
+            if (p[1] == '\0') {
+                return -EINVAL;
+            }
+            ret = put(e, p + 1, 1);
+            e->pos += 2;
+        } else if (*p == '$') {
+            ret = expand_param(e);
+        } else if (strchr("`|&;<>(){}\n", *p)) {
+            // what sh would run, redirect or group
+            return -EINVAL;
+        } else {
+            size_t n = 1 + strcspn(p + 1, SPECIAL);
+            ret = put(e, p, n);
+            e->pos += n;
+        }
+
+        if (ret < 0) {
+            return ret;
+        }
+    }
+}
+
+int expand_words(const char *value, char **out, size_t *size)
+{
+    // enough unless something expands to more than it takes to write it
+    struct expander e = {.pos = value, .size = strlen(value) + 1};
+    e.buf = malloc(e.size);
+    if (e.buf == NULL) {
+        return -ENOMEM;
+    }
+
+    int ret = expand_until(&e, false);
+    if (ret < 0) {
+        free(e.buf);
+        return ret;
+    }
+    end_word(&e);
+
+    *out = e.buf;
+    *size = e.len;
+    return e.words;
+}
+
+#endif
@@ -0,0 +1,411 @@
+#include "launcher.h"
+#include "logger.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARGV(...) ((const char *const[]){__VA_ARGS__, NULL})
+
+struct launcher_preset {
+    const char *name;
+    const char *const *argv[LAUNCH_NUM_MODES];
+    bool terminal;
+    enum LauncherPost post;
+};
+
+// built-in equivalents of the contrib wrappers
+static const struct launcher_preset presets[] = {
+    {
+        .name = "yazi",
+        .argv =
+            {
+                [LAUNCH_FILE] = ARGV("yazi", "--chooser-file=%o", "%p"),
+                [LAUNCH_FILES] = ARGV("yazi", "--chooser-file=%o", "%p"),
+                [LAUNCH_DIR] = ARGV("yazi", "--chooser-file=%o",
+                                    "--cwd-file=%c", "%p"),
+                [LAUNCH_SAVE] = ARGV("yazi", "--chooser-file=%o", "%p"),
+            },
+        .terminal = true,
+        .post = POST_CWD_FILE,
+    },
+    {
+        .name = "lf",
+        .argv =
+            {
+                [LAUNCH_FILE] = ARGV("lf", "-selection-path", "%o", "%p"),
+                [LAUNCH_FILES] = ARGV("lf", "-selection-path", "%o", "%p"),
+                [LAUNCH_DIR] = ARGV("lf", "-last-dir-path", "%o", "%p"),
+                [LAUNCH_SAVE] = ARGV("lf", "-selection-path", "%o", "%p"),
+            },
+        .terminal = true,
+    },
+    {
+        .name = "nnn",
+        .argv =
+            {
+                [LAUNCH_FILE] = ARGV("nnn", "-p", "%o", "%p"),
+                [LAUNCH_FILES] = ARGV("nnn", "-p", "%o", "%p"),
+                [LAUNCH_DIR] = ARGV("NNN_TMPFILE=%o", "nnn", "-p", "%o", "%p"),
+                [LAUNCH_SAVE] = ARGV("nnn", "-p", "%o", "%p"),
+            },
+        .terminal = true,
+        .post = POST_NNN_CD,
+    },
+    {
+        .name = "ranger",
+        .argv =
+            {
+                [LAUNCH_FILE] = ARGV("ranger", "--choosefile=%o",
+                                     "--cmd=echo Select file (open file to "
+                                     "select it)",
+                                     "%p"),
+                [LAUNCH_FILES] = ARGV("ranger", "--choosefiles=%o",
+                                      "--cmd=echo Select file(s) (open file "
+                                      "to select it; <Space> to select "
+                                      "multiple)",
+                                      "%p"),
+                [LAUNCH_DIR] = ARGV("ranger", "--choosedir=%o",
+                                    "--show-only-dirs",
+                                    "--cmd=echo Select directory (quit in dir "
+                                    "to select it)",
+                                    "%p"),
+                [LAUNCH_SAVE] = ARGV("ranger", "--choosefile=%o",
+                                     "--cmd=echo Select save path (see "
+                                     "tutorial in preview pane; try pressing "
+                                     "zv or zp if no preview)",
+                                     "--selectfile=%p"),
+            },
+        .terminal = true,
+    },
+    {
+        .name = "vifm",
+        .argv =
+            {
+                [LAUNCH_FILE] =
+                    ARGV("vifm", "--choose-files", "%o", "-c", "only", "-c",
+                         "map <esc> :cquit<cr>", "-c",
+                         "set statusline='Select file (open file to select "
+                         "it, press <Esc> to cancel)'"),
+                [LAUNCH_FILES] =
+                    ARGV("vifm", "--choose-files", "%o", "-c", "only", "-c",
+                         "map <esc> :cquit<cr>", "-c",
+                         "set statusline='Select file(s) (press <t> key to "
+                         "select multiple, press <Esc> to cancel)'"),
+                [LAUNCH_DIR] =
+                    ARGV("vifm", "--choose-files", "%o", "--choose-dir", "%o",
+                         "-c", "only", "-c", "map <esc> :cquit<cr>", "-c",
+                         "set statusline='Select directory (:quit in dir or "
+                         "select and open it, press <Esc> to cancel)'"),
+                [LAUNCH_SAVE] =
+                    ARGV("vifm", "--choose-files", "%o", "-c", "only", "-c",
+                         "map <esc> :cquit<cr>", "-c",
+                         "set statusline='Save file (press <Enter> to select "
+                         "or <Esc> to cancel)%NCursorfile is the recommended "
+                         "choice, you can rename/move it%NIf you select "
+                         "another file, it will be overwritten by the save'",
+                         "--select", "%p"),
+            },
+        .terminal = true,
+    },
+    {
+        .name = "superfile",
+        .argv =
+            {
+                [LAUNCH_FILE] = ARGV("spf", "--chooser-file=%o", "%p"),
+                [LAUNCH_FILES] = ARGV("spf", "--chooser-file=%o", "%p"),
+                [LAUNCH_DIR] = ARGV("spf", "--chooser-file=%o", "%p"),
+                [LAUNCH_SAVE] = ARGV("spf", "--chooser-file=%o", "%p"),
+            },
+        .terminal = true,
+    },
+    {
+        .name = "kitty",
+        .argv =
+            {
+                [LAUNCH_FILE] = ARGV("kitty", "--class", "filechooser",
+                                     "kitty", "+kitten", "choose-files",
+                                     "--mode=file", "--write-output-to", "%o"),
+                [LAUNCH_FILES] = ARGV("kitty", "--class", "filechooser",
+                                      "kitty", "+kitten", "choose-files",
+                                      "--mode=files", "--write-output-to",
+                                      "%o"),
+                [LAUNCH_DIR] = ARGV("kitty", "--class", "filechooser",
+                                    "kitty", "+kitten", "choose-files",
+                                    "--mode=dir", "--write-output-to", "%o"),
+                [LAUNCH_SAVE] = ARGV("kitty", "--class", "filechooser",
+                                     "kitty", "+kitten", "choose-files",
+                                     "--mode=save-file", "--write-output-to",
+                                     "%o", "--suggested-save-file-name", "%q"),
+            },
+        .terminal = false,
+    },
+};
+
+bool launcher_is_set(const struct launcher_spec *spec)
+{
+    for (int mode = 0; mode < LAUNCH_NUM_MODES; mode++) {
+        if (spec->argc[mode] > 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void launcher_set_mode(struct launcher_spec *spec, enum LauncherMode mode,
+                       char **argv, int argc)
+{
+    for (int i = 0; i < spec->argc[mode]; i++) {
+        free(spec->argv[mode][i]);
+    }
+    free(spec->argv[mode]);
+    spec->argv[mode] = argv;
+    spec->argc[mode] = argc;
+}
+
+void launcher_free(struct launcher_spec *spec)
+{
+    for (int mode = 0; mode < LAUNCH_NUM_MODES; mode++) {
+        launcher_set_mode(spec, mode, NULL, 0);
+    }
+}
+
+int launcher_set_preset(struct launcher_spec *spec, const char *name)
+{
+    const struct launcher_preset *preset = NULL;
+    for (size_t i = 0; i < sizeof(presets) / sizeof(presets[0]); i++) {
+        if (strcmp(presets[i].name, name) == 0) {
+            preset = &presets[i];
+            break;
+        }
+    }
+    if (preset == NULL) {
+        return -1;
+    }
+
+    for (int mode = 0; mode < LAUNCH_NUM_MODES; mode++) {
+        int argc = 0;
+        while (preset->argv[mode][argc]) {
+            argc++;
+        }
+        char **argv = malloc(argc * sizeof(char *));
+        for (int i = 0; i < argc; i++) {
+            argv[i] = strdup(preset->argv[mode][i]);
+        }
+        launcher_set_mode(spec, mode, argv, argc);
+    }
+    spec->terminal = preset->terminal;
+    spec->post = preset->post;
+    return 0;
+}
+
+int launcher_set_post(struct launcher_spec *spec, const char *name)
+{
+    if (strcmp(name, "none") == 0) {
+        spec->post = POST_NONE;
+    } else if (strcmp(name, "cwd_file") == 0) {
+        spec->post = POST_CWD_FILE;
+    } else if (strcmp(name, "nnn_cd") == 0) {
+        spec->post = POST_NNN_CD;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+enum LauncherMode launcher_mode(bool writing, bool multiple, bool directory)
+{
+    if (writing) {
+        return LAUNCH_SAVE;
+    } else if (directory) {
+        return LAUNCH_DIR;
+    } else if (multiple) {
+        return LAUNCH_FILES;
+    }
+    return LAUNCH_FILE;
+}
+
+bool launcher_uses_side_file(const struct launcher_spec *spec,
+                             enum LauncherMode mode)
+{
+    for (int i = 0; i < spec->argc[mode]; i++) {
+        if (strstr(spec->argv[mode][i], "%c")) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool is_assignment(const char *word)
+{
+    const char *ptr = word;
+    while (isalnum((unsigned char)*ptr) || *ptr == '_') {
+        ptr++;
+    }
+    return ptr != word && *ptr == '=';
+}
+
+// expands the placeholders of a single template word
+static char *expand_word(const char *word, const char *path, const char *out,
+                         const char *side)
+{
+    char *expanded = NULL;
+    size_t len = 0;
+    FILE *fp = open_memstream(&expanded, &len);
+    for (const char *ptr = word; *ptr; ptr++) {
+        if (*ptr != '%' || ptr[1] == '\0') {
+            fputc(*ptr, fp);
+            continue;
+        }
+
+        switch (*++ptr) {
+            case 'p':
+                fputs(path, fp);
+                break;
+            case 'o':
+                fputs(out, fp);
+                break;
+            case 'c':
+                fputs(side ? side : "", fp);
+                break;
+            case 'q':
+                fputc('"', fp);
+                for (const char *src = path; *src; src++) {
+                    if (*src == '"') {
+                        fputc('\\', fp);
+                    }
+                    fputc(*src, fp);
+                }
+                fputc('"', fp);
+                break;
+            case '%':
+                fputc('%', fp);
+                break;
+            default:
+                // unknown placeholders are kept as they are
+                fputc('%', fp);
+                fputc(*ptr, fp);
+                break;
+        }
+    }
+    fclose(fp);
+    return expanded;
+}
+
+char **launcher_expand(const struct launcher_spec *spec,
+                       enum LauncherMode mode, char *const *prefix,
+                       int prefix_len, const char *path, const char *out,
+                       const char *side)
+{
+    int argc = spec->argc[mode];
+    if (argc == 0) {
+        return NULL;
+    }
+
+    // prefix, env and its assignments, then the file manager
+    char **argv = calloc(prefix_len + 1 + argc + 1, sizeof(char *));
+    int pos = 0;
+    for (int i = 0; i < prefix_len; i++) {
+        argv[pos++] = strdup(prefix[i]);
+    }
+
+    int first = 0;
+    while (first < argc - 1 && is_assignment(spec->argv[mode][first])) {
+        first++;
+    }
+    // env(1) instead of our own environment, so assignments also make it
+    // through TERMCMD and a pooled terminal
+    if (first > 0) {
+        argv[pos++] = strdup("env");
+    }
+    for (int i = 0; i < argc; i++) {
+        argv[pos++] = expand_word(spec->argv[mode][i], path, out, side);
+    }
+    argv[pos] = NULL;
+    return argv;
+}
+
+void launcher_free_argv(char **argv)
+{
+    if (argv == NULL) {
+        return;
+    }
+    for (char **ptr = argv; *ptr; ptr++) {
+        free(*ptr);
+    }
+    free(argv);
+}
+
+static int read_side_file(const char *side, char **data, size_t *size)
+{
+    FILE *fp = fopen(side, "re");
+    if (fp == NULL) {
+        return -1;
+    }
+
+    char *buf = NULL;
+    size_t len = 0;
+    FILE *mem = open_memstream(&buf, &len);
+    char chunk[4096];
+    size_t nread;
+    while ((nread = fread(chunk, 1, sizeof(chunk), fp)) > 0) {
+        fwrite(chunk, 1, nread, mem);
+    }
+    fclose(fp);
+    fclose(mem);
+
+    if (len == 0) {
+        free(buf);
+        return -1;
+    }
+    free(*data);
+    *data = buf;
+    *size = len;
+    return 0;
+}
+
+// nnn writes "cd '/dir'" on quit, with ' escaped as '\''
+static void strip_nnn_cd(char **data, size_t *size)
+{
+    const char *prefix = "cd '";
+    if (*size < strlen(prefix) || strncmp(*data, prefix, strlen(prefix))) {
+        return;
+    }
+
+    char *path = malloc(*size + 1);
+    size_t len = 0;
+    for (const char *ptr = *data + strlen(prefix); *ptr; ptr++) {
+        if (strncmp(ptr, "'\\''", 4) == 0) {
+            path[len++] = '\'';
+            ptr += 3;
+        } else if (*ptr == '\'') {
+            break;
+        } else {
+            path[len++] = *ptr;
+        }
+    }
+    path[len++] = '\n';
+    path[len] = '\0';
+
+    free(*data);
+    *data = path;
+    *size = len;
+}
+
+int launcher_post_process(const struct launcher_spec *spec, char **data,
+                          size_t *size, const char *side)
+{
+    switch (spec->post) {
+        case POST_NONE:
+            break;
+        case POST_CWD_FILE:
+            if (*size == 0 && side && read_side_file(side, data, size) == 0) {
+                logprint(DEBUG, "launcher: using the cwd file as selection");
+            }
+            break;
+        case POST_NNN_CD:
+            strip_nnn_cd(data, size);
+            break;
+    }
+    return 0;
+}
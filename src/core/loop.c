@@ -0,0 +1,153 @@
+#include "logger.h"
+#include "xdptf.h"
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+int xdptf_loop_add(struct xdptf_state *state, int fd, short events,
+                   xdptf_loop_handler handler, void *data)
+{
+    struct xdptf_watch *watch = calloc(1, sizeof(struct xdptf_watch));
+    if (watch == NULL) {
+        return -ENOMEM;
+    }
+
+    watch->fd = fd;
+    watch->events = events;
+    watch->handler = handler;
+    watch->data = data;
+
+    // append, so watches are dispatched in the order they were added
+    struct xdptf_watch **tail = &state->watches;
+    while (*tail) {
+        tail = &(*tail)->next;
+    }
+    *tail = watch;
+
+    logprint(TRACE, "loop: watching fd %d", fd);
+    return 0;
+}
+
+// NOTE: watches are only marked here and freed by the next xdptf_loop_wait,
+// so a handler may remove its own (or any other) watch while dispatching
+void xdptf_loop_remove(struct xdptf_state *state, int fd)
+{
+    for (struct xdptf_watch *watch = state->watches; watch;
+         watch = watch->next) {
+        if (watch->fd == fd) {
+            logprint(TRACE, "loop: removing fd %d", fd);
+            watch->fd = -1;
+            return;
+        }
+    }
+}
+
+static void sweep_watches(struct xdptf_state *state)
+{
+    struct xdptf_watch **next = &state->watches;
+    while (*next) {
+        struct xdptf_watch *watch = *next;
+        if (watch->fd < 0) {
+            *next = watch->next;
+            free(watch);
+        } else {
+            next = &watch->next;
+        }
+    }
+}
+
+static int bus_timeout_ms(sd_bus *bus)
+{
+    uint64_t until = 0;
+    if (sd_bus_get_timeout(bus, &until) < 0 || until == UINT64_MAX) {
+        return -1;
+    }
+
+    uint64_t now = xdptf_now_usec();
+    if (until <= now) {
+        return 0;
+    }
+
+    // round up so we never wake before the bus is ready
+    uint64_t ms = (until - now + 999) / 1000;
+    return ms > INT32_MAX ? INT32_MAX : (int)ms;
+}
+
+int xdptf_loop_wait(struct xdptf_state *state)
+{
+    sweep_watches(state);
+
+    size_t num_watches = 0;
+    for (struct xdptf_watch *watch = state->watches; watch;
+         watch = watch->next) {
+        num_watches++;
+    }
+
+    struct pollfd *fds = calloc(1 + num_watches, sizeof(struct pollfd));
+    struct xdptf_watch **watches =
+        calloc(1 + num_watches, sizeof(struct xdptf_watch *));
+    if (fds == NULL || watches == NULL) {
+        free(fds);
+        free(watches);
+        return -ENOMEM;
+    }
+
+    int ret = sd_bus_get_fd(state->bus);
+    if (ret < 0) {
+        goto cleanup;
+    }
+    fds[0].fd = ret;
+
+    ret = sd_bus_get_events(state->bus);
+    if (ret < 0) {
+        goto cleanup;
+    }
+    fds[0].events = ret;
+
+    size_t i = 1;
+    for (struct xdptf_watch *watch = state->watches; watch;
+         watch = watch->next, i++) {
+        fds[i].fd = watch->fd;
+        fds[i].events = watch->events;
+        watches[i] = watch;
+    }
+
+    ret = poll(fds, 1 + num_watches, bus_timeout_ms(state->bus));
+    if (ret < 0) {
+        // a signal; the caller checks what it asked for
+        ret = errno == EINTR ? 0 : -errno;
+        goto cleanup;
+    }
+
+    for (i = 1; i <= num_watches; i++) {
+        // skip watches removed by an earlier handler in this round
+        if (fds[i].revents == 0 || watches[i]->fd < 0) {
+            continue;
+        }
+        int handler_ret = watches[i]->handler(state, fds[i].fd,
+                                              fds[i].revents, watches[i]->data);
+        if (handler_ret < 0) {
+            logprint(ERROR, "loop: handler for fd %d failed: %s", fds[i].fd,
+                     strerror(-handler_ret));
+        }
+    }
+    ret = 0;
+
+cleanup:
+    free(fds);
+    free(watches);
+    return ret;
+}
+
+void xdptf_loop_finish(struct xdptf_state *state)
+{
+    struct xdptf_watch *watch = state->watches;
+    while (watch) {
+        struct xdptf_watch *next = watch->next;
+        free(watch);
+        watch = next;
+    }
+    state->watches = NULL;
+}
@@ -1,17 +1,26 @@
 #include "config.h"
 #include "logger.h"
 #include "xdptf.h"
+#include <errno.h>
 #include <getopt.h>
+#include <poll.h>
 #include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/timerfd.h>
 #include <unistd.h>
 
 static volatile bool keep_running = true;
+static volatile sig_atomic_t flush_trace = 0;
+static bool idle_expired = false;
+// read at startup only, like the pool settings
+static int idle_timeout = 0;
 
 void handle_sigterm(int sig) { keep_running = false; }
 
+void handle_sigusr1(int sig) { flush_trace = 1; }
+
 static const char service_name[] =
     "org.freedesktop.impl.portal.desktop.termfilechooser";
 
@@ -27,6 +36,10 @@ static int xdptf_usage(FILE *stream, int rc)
         "    -c, --config=<config file>       Select config file.\n"
         "                                     (default is "
         "$XDG_CONFIG_HOME/xdg-desktop-portal-termfilechooser/config)\n"
+        "    -t, --trace=<trace file>         Record request spans and write "
+        "them as\n"
+        "                                     Chrome trace JSON on SIGUSR1 and "
+        "exit.\n"
         "    -r, --replace                    Replace a running instance.\n"
         "    -v, --version                    Print the current version.\n"
         "    -h, --help                       Get help (this text).\n"
@@ -51,6 +64,34 @@ static int handle_name_lost(sd_bus_message *m, void *userdata,
     return 1;
 }
 
+static int handle_request_name(sd_bus_message *m, void *userdata,
+                               sd_bus_error *ret_error)
+{
+    const sd_bus_error *error = sd_bus_message_get_error(m);
+    if (error) {
+        logprint(ERROR, "dbus: failed to acquire service name: %s",
+                 error->message);
+        // without the name, no request would ever reach us
+        keep_running = false;
+        return 1;
+    }
+
+    // 1 is DBUS_REQUEST_NAME_REPLY_PRIMARY_OWNER, 4 ALREADY_OWNER
+    uint32_t reply = 0;
+    sd_bus_message_read(m, "u", &reply);
+    if (reply == 1 || reply == 4) {
+        logprint(DEBUG, "dbus: acquired service name");
+    } else {
+        logprint(ERROR, "dbus: failed to acquire service name: %s",
+                 strerror(EEXIST));
+        keep_running = false;
+    }
+    return 1;
+}
+
+// Nothing here waits for the bus: the name is requested and the match added
+// asynchronously, so an activated instance gets to the main loop, where the
+// calls that activated it are waiting, without any round trips.
 static int setup_sd_bus(sd_bus **bus, sd_bus_slot **slot,
                         const char *service_name, bool replace)
 {
@@ -69,10 +110,12 @@ static int setup_sd_bus(sd_bus **bus, sd_bus_slot **slot,
         flags |= SD_BUS_NAME_REPLACE_EXISTING;
     }
 
-    ret = sd_bus_request_name(*bus, service_name, flags);
+    ret = sd_bus_request_name_async(*bus, NULL, service_name, flags,
+                                    handle_request_name, NULL);
     if (ret < 0) {
         logprint(ERROR, "dbus: failed to acquire service name: %s",
                  strerror(-ret));
+        return ret;
     }
 
     const char *unique_name;
@@ -94,7 +137,8 @@ static int setup_sd_bus(sd_bus **bus, sd_bus_slot **slot,
              "arg1='%s',",
              service_name, unique_name);
 
-    ret = sd_bus_add_match(*bus, slot, match, handle_name_lost, NULL);
+    ret = sd_bus_add_match_async(*bus, slot, match, handle_name_lost, NULL,
+                                 NULL);
     if (ret < 0) {
         logprint(ERROR, "dbus: failed to add NameOwnerChanged signal match: %s",
                  strerror(-ret));
@@ -104,8 +148,67 @@ static int setup_sd_bus(sd_bus **bus, sd_bus_slot **slot,
     return 0;
 }
 
-static void cleanup(sd_bus **bus, sd_bus_slot **slot, void *config,
-                    char **configfile)
+static int handle_idle_check(struct xdptf_state *state, int fd,
+                             short revents, void *data)
+{
+    uint64_t expirations;
+    if (read(fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN) {
+        return -errno;
+    }
+
+    uint64_t max_idle = (uint64_t)idle_timeout * 1000000;
+    if (xdptf_request_idle(state) &&
+        xdptf_now_usec() - state->requests.idle_since_usec >= max_idle) {
+        idle_expired = true;
+    }
+    return 0;
+}
+
+// checks twice per timeout, like the pool does, so the daemon does not
+// stay around much longer than asked
+static int setup_idle_exit(struct xdptf_state *state)
+{
+    int timeout = idle_timeout = state->config->idle_timeout;
+    if (timeout <= 0) {
+        return -1;
+    }
+
+    state->requests.idle_since_usec = xdptf_now_usec();
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    struct itimerspec spec = {
+        .it_interval = {.tv_sec = timeout < 2 ? 1 : timeout / 2},
+        .it_value = {.tv_sec = timeout < 2 ? 1 : timeout / 2},
+    };
+    if (fd < 0 || timerfd_settime(fd, 0, &spec, NULL) < 0 ||
+        xdptf_loop_add(state, fd, POLLIN, handle_idle_check, NULL) < 0) {
+        logprint(WARN, "main: could not set up the idle timeout: %s",
+                 strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+
+    logprint(DEBUG, "main: exiting after %d idle seconds", timeout);
+    return fd;
+}
+
+// gives the name back so the next call activates a new instance; calls that
+// were routed to us before that are still queued and get served
+static int release_name(sd_bus *bus, sd_bus_slot **slot)
+{
+    // releasing the name would trip the name lost handler otherwise
+    *slot = sd_bus_slot_unref(*slot);
+
+    int ret = sd_bus_release_name(bus, service_name);
+    if (ret < 0) {
+        logprint(ERROR, "dbus: failed to release service name: %s",
+                 strerror(-ret));
+    }
+    return ret;
+}
+
+static void cleanup(sd_bus **bus, sd_bus_slot **slot)
 {
     sd_bus_slot_unref(*slot);
     *slot = NULL;
@@ -113,25 +216,26 @@ static void cleanup(sd_bus **bus, sd_bus_slot **slot, void *config,
     sd_bus_close(*bus);
     sd_bus_unref(*bus);
     *bus = NULL;
-
-    free_config(config);
-    free(*configfile);
 }
 
 int main(int argc, char *argv[])
 {
     signal(SIGTERM, handle_sigterm);
     signal(SIGINT, handle_sigterm);
+    signal(SIGUSR1, handle_sigusr1);
 
-    struct config_filechooser config = {0};
+    struct config_filechooser *config =
+        calloc(1, sizeof(struct config_filechooser));
     char *configfile = NULL;
     enum LOGLEVEL loglevel = DEFAULT_LOGLEVEL;
     bool replace = false;
+    char *tracefile = NULL;
 
-    static const char *shortopts = "l:c:rhv";
+    static const char *shortopts = "l:c:t:rhv";
     static const struct option longopts[] = {
         {"loglevel", required_argument, NULL, 'l'},
         {"config", required_argument, NULL, 'c'},
+        {"trace", required_argument, NULL, 't'},
         {"replace", no_argument, NULL, 'r'},
         {"version", no_argument, NULL, 'v'},
         {"help", no_argument, NULL, 'h'},
@@ -150,6 +254,9 @@ int main(int argc, char *argv[])
             case 'c':
                 configfile = strdup(optarg);
                 break;
+            case 't':
+                tracefile = optarg;
+                break;
             case 'r':
                 replace = true;
                 break;
@@ -164,8 +271,13 @@ int main(int argc, char *argv[])
     }
 
     init_logger(stderr, loglevel);
-    init_config(&configfile, &config);
-    print_config(DEBUG, &config);
+    if (tracefile && xdptf_trace_init(tracefile) < 0) {
+        logprint(ERROR, "trace: could not allocate the trace buffer");
+    }
+    // a reload looks the config up again, unless it was given
+    char *configfile_arg = configfile ? strdup(configfile) : NULL;
+    init_config(&configfile, config);
+    print_config(DEBUG, config);
 
     int ret;
 
@@ -173,16 +285,25 @@ int main(int argc, char *argv[])
     sd_bus_slot *slot = NULL;
     ret = setup_sd_bus(&bus, &slot, service_name, replace);
     if (ret < 0) {
-        cleanup(&bus, &slot, &config, &configfile);
+        cleanup(&bus, &slot);
+        config_unref(config);
+        free(configfile);
+        free(configfile_arg);
         return EXIT_FAILURE;
     }
 
     struct xdptf_state state = {
         .bus = bus,
-        .config = &config,
+        .config = config,
     };
 
     xdptf_filechooser_init(&state);
+    xdptf_last_dir_init(&state);
+    xdptf_stats_init(&state);
+    xdptf_pool_init(&state);
+    xdptf_reload_init(&state, configfile_arg, configfile);
+    int idle_fd = setup_idle_exit(&state);
+    bool released = false;
 
     while (keep_running) {
         ret = sd_bus_process(state.bus, NULL);
@@ -194,16 +315,51 @@ int main(int argc, char *argv[])
         if (ret > 0)
             continue;
 
-        ret = sd_bus_wait(state.bus, (uint64_t)-1);
+        // a request may have come in since the timer fired
+        if (idle_expired && !released) {
+            idle_expired = false;
+            if (xdptf_request_idle(&state)) {
+                logprint(INFO, "main: idle for %d seconds, exiting",
+                         idle_timeout);
+                released = true;
+                release_name(state.bus, &slot);
+                continue;
+            }
+        }
+        if (released && xdptf_request_idle(&state)) {
+            break;
+        }
+
+        // wait on the bus and on running choosers alike, so requests are
+        // served while a picker is open
+        ret = xdptf_loop_wait(&state);
         if (ret < 0) {
-            logprint(ERROR, "dbus: sd_bus_wait failed: %s", strerror(-ret));
+            logprint(ERROR, "dbus: waiting for events failed: %s",
+                     strerror(-ret));
             break;
         }
 
+        if (flush_trace) {
+            flush_trace = 0;
+            xdptf_trace_flush();
+        }
+
         logprint(TRACE, "dbus: flushing bus");
         sd_bus_flush(state.bus);
     }
 
-    cleanup(&bus, &slot, &config, &configfile);
+    if (idle_fd >= 0) {
+        xdptf_loop_remove(&state, idle_fd);
+        close(idle_fd);
+    }
+    xdptf_reload_finish(&state);
+    xdptf_request_cancel_all(&state);
+    xdptf_last_dir_finish(&state);
+    xdptf_pool_finish(&state);
+    xdptf_stats_finish(&state.stats);
+    xdptf_trace_finish();
+    xdptf_loop_finish(&state);
+    cleanup(&bus, &slot);
+    config_unref(state.config);
     return EXIT_SUCCESS;
 }
@@ -0,0 +1,301 @@
+#include "pool.h"
+#include "config.h"
+#include "logger.h"
+#include "xdptf.h"
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define POOL_SHELL "pool-shell.sh"
+// a terminal dying faster than this is broken, not closed by the user
+#define POOL_MIN_LIFETIME_USEC 1000000
+
+static const char *pool_termcmd(struct config_filechooser *config)
+{
+    if (config->pool_termcmd) {
+        return config->pool_termcmd;
+    }
+    const char *termcmd = get_config_env(config, "TERMCMD");
+    return termcmd ? termcmd : DEFAULT_TERMCMD;
+}
+
+static void free_terminal(struct xdptf_state *state,
+                          struct xdptf_pool_terminal *terminal)
+{
+    if (terminal->child_fd >= 0) {
+        xdptf_loop_remove(state, terminal->child_fd);
+        close(terminal->child_fd);
+    }
+    unlink(terminal->fifo);
+    unlink(terminal->done_fifo);
+    free(terminal->fifo);
+    free(terminal->done_fifo);
+    free(terminal);
+}
+
+static void unlink_terminal(struct xdptf_pool *pool,
+                            struct xdptf_pool_terminal *terminal)
+{
+    struct xdptf_pool_terminal **next = &pool->terminals;
+    while (*next) {
+        if (*next == terminal) {
+            *next = terminal->next;
+            break;
+        }
+        next = &(*next)->next;
+    }
+    if (!terminal->busy) {
+        pool->num_idle--;
+    }
+}
+
+static int handle_terminal_exit(struct xdptf_state *state, int fd,
+                                short revents, void *data)
+{
+    struct xdptf_pool_terminal *terminal = data;
+    int status;
+    if (!xdptf_child_reap(fd, terminal->pid, &status)) {
+        return 0;
+    }
+    logprint(DEBUG, "pool: terminal %d exited", terminal->pid);
+    xdptf_trace_span(0, "terminal", terminal->spawn_usec, xdptf_now_usec(),
+                     terminal->pid);
+
+    xdptf_loop_remove(state, terminal->child_fd);
+    close(terminal->child_fd);
+    terminal->child_fd = -1;
+    terminal->exited = true;
+    if (terminal->owned) {
+        return 0;
+    }
+
+    bool was_idle = !terminal->busy;
+    bool broken =
+        xdptf_now_usec() - terminal->spawn_usec < POOL_MIN_LIFETIME_USEC;
+    unlink_terminal(&state->pool, terminal);
+    free_terminal(state, terminal);
+
+    if (was_idle && broken) {
+        logprint(WARN, "pool: terminal exited right away; check that "
+                       "pool_termcmd stays in the foreground");
+    } else if (was_idle) {
+        xdptf_pool_fill(state);
+    }
+    return 0;
+}
+
+static char *pool_fifo_path(const char *runtime_dir, unsigned int serial,
+                            const char *suffix)
+{
+    size_t path_size =
+        1 + snprintf(NULL, 0, "%s/termfilechooser-pool-%d-%u%s", runtime_dir,
+                     getpid(), serial, suffix);
+    char *path = malloc(path_size);
+    snprintf(path, path_size, "%s/termfilechooser-pool-%d-%u%s", runtime_dir,
+             getpid(), serial, suffix);
+    return path;
+}
+
+static int spawn_terminal(struct xdptf_state *state)
+{
+    const char *runtime_dir = getenv("XDG_RUNTIME_DIR");
+    if (runtime_dir == NULL || *runtime_dir == '\0') {
+        logprint(WARN, "pool: XDG_RUNTIME_DIR is not set");
+        return -1;
+    }
+
+    struct xdptf_pool *pool = &state->pool;
+    struct xdptf_pool_terminal *terminal =
+        calloc(1, sizeof(struct xdptf_pool_terminal));
+    terminal->child_fd = -1;
+    terminal->fifo = pool_fifo_path(runtime_dir, pool->serial, ".fifo");
+    terminal->done_fifo = pool_fifo_path(runtime_dir, pool->serial, ".done");
+    pool->serial++;
+
+    if (mkfifo(terminal->fifo, 0600) == -1 ||
+        mkfifo(terminal->done_fifo, 0600) == -1) {
+        logprint(WARN, "pool: could not create fifo: %s", strerror(errno));
+        free_terminal(state, terminal);
+        return -1;
+    }
+
+    const char *termcmd = pool_termcmd(state->config);
+    size_t cmd_size = 1 + snprintf(NULL, 0, "%s %s serve '%s' '%s'", termcmd,
+                                   POOL_SHELL, terminal->fifo,
+                                   terminal->done_fifo);
+    char *cmd = malloc(cmd_size);
+    snprintf(cmd, cmd_size, "%s %s serve '%s' '%s'", termcmd, POOL_SHELL,
+             terminal->fifo, terminal->done_fifo);
+
+    // the wrapper PATH is in envp, for sh to find the pool shell
+    int ret = xdptf_spawn_shell(cmd, state->config->envp, &terminal->pid);
+    free(cmd);
+    if (ret < 0) {
+        free_terminal(state, terminal);
+        return -1;
+    }
+
+    ret = xdptf_watch_child(state, terminal->pid, handle_terminal_exit,
+                            terminal);
+    if (ret < 0) {
+        logprint(WARN, "pool: could not watch terminal %d: %s", terminal->pid,
+                 strerror(-ret));
+        kill(-terminal->pid, SIGTERM);
+        waitpid(terminal->pid, NULL, 0);
+        free_terminal(state, terminal);
+        return -1;
+    }
+    terminal->child_fd = ret;
+
+    terminal->spawn_usec = xdptf_now_usec();
+    terminal->next = pool->terminals;
+    pool->terminals = terminal;
+    pool->num_idle++;
+    logprint(DEBUG, "pool: spawned terminal %d", terminal->pid);
+    return 0;
+}
+
+void xdptf_pool_fill(struct xdptf_state *state)
+{
+    while (state->pool.num_idle < state->pool.size) {
+        if (spawn_terminal(state) < 0) {
+            break;
+        }
+    }
+}
+
+static int handle_expiry(struct xdptf_state *state, int fd, short revents,
+                         void *data)
+{
+    uint64_t expirations;
+    if (read(fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN) {
+        return -errno;
+    }
+
+    // replaces what the last check expired, so the pool never stays empty
+    xdptf_pool_fill(state);
+
+    uint64_t max_idle = (uint64_t)state->pool.idle_timeout * 1000000;
+    uint64_t now = xdptf_now_usec();
+    for (struct xdptf_pool_terminal *terminal = state->pool.terminals;
+         terminal; terminal = terminal->next) {
+        if (!terminal->busy && now - terminal->spawn_usec >= max_idle) {
+            // marked busy, so its exit does not trigger a refill; the next
+            // check refills the pool instead, after the terminal has gone
+            logprint(DEBUG, "pool: expiring idle terminal %d", terminal->pid);
+            terminal->busy = true;
+            state->pool.num_idle--;
+            kill(-terminal->pid, SIGTERM);
+        }
+    }
+    return 0;
+}
+
+void xdptf_pool_init(struct xdptf_state *state)
+{
+    state->pool.timerfd = -1;
+    state->pool.size = state->config->pool_size;
+    state->pool.idle_timeout = state->config->pool_idle_timeout;
+    if (state->pool.size <= 0) {
+        return;
+    }
+
+    int timeout = state->pool.idle_timeout;
+    if (timeout > 0) {
+        state->pool.timerfd =
+            timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        // check twice per timeout, so no terminal idles much longer
+        struct itimerspec spec = {
+            .it_interval = {.tv_sec = timeout / 2, .tv_nsec = 0},
+            .it_value = {.tv_sec = timeout / 2, .tv_nsec = 0},
+        };
+        if (timeout < 2) {
+            spec.it_interval.tv_sec = spec.it_value.tv_sec = 1;
+        }
+        if (state->pool.timerfd < 0 ||
+            timerfd_settime(state->pool.timerfd, 0, &spec, NULL) < 0 ||
+            xdptf_loop_add(state, state->pool.timerfd, POLLIN, handle_expiry,
+                           NULL) < 0) {
+            logprint(WARN, "pool: could not set up idle expiry: %s",
+                     strerror(errno));
+        }
+    }
+
+    logprint(DEBUG, "pool: keeping %d terminals warm", state->pool.size);
+    xdptf_pool_fill(state);
+}
+
+struct xdptf_pool_terminal *xdptf_pool_take(struct xdptf_state *state)
+{
+    if (state->pool.size <= 0) {
+        return NULL;
+    }
+
+    struct xdptf_pool_terminal *found = NULL;
+    for (struct xdptf_pool_terminal *terminal = state->pool.terminals;
+         terminal; terminal = terminal->next) {
+        if (!terminal->busy) {
+            found = terminal;
+            break;
+        }
+    }
+
+    if (found) {
+        found->busy = true;
+        found->owned = true;
+        state->pool.num_idle--;
+        logprint(DEBUG, "pool: handing out terminal %d", found->pid);
+    }
+
+    // replenish right away, so the next request finds a warm terminal too
+    xdptf_pool_fill(state);
+    return found;
+}
+
+void xdptf_pool_release(struct xdptf_state *state,
+                        struct xdptf_pool_terminal *terminal)
+{
+    if (terminal == NULL) {
+        return;
+    }
+
+    terminal->owned = false;
+    if (terminal->exited) {
+        unlink_terminal(&state->pool, terminal);
+        free_terminal(state, terminal);
+        return;
+    }
+
+    // the terminal normally exits with the chooser; make sure it does not
+    // linger if the wrapper never used it. It is reaped from the loop.
+    logprint(TRACE, "pool: terminating terminal %d", terminal->pid);
+    kill(-terminal->pid, SIGTERM);
+}
+
+void xdptf_pool_finish(struct xdptf_state *state)
+{
+    struct xdptf_pool_terminal *terminal = state->pool.terminals;
+    while (terminal) {
+        struct xdptf_pool_terminal *next = terminal->next;
+        if (!terminal->exited) {
+            kill(-terminal->pid, SIGTERM);
+            waitpid(terminal->pid, NULL, 0);
+        }
+        free_terminal(state, terminal);
+        terminal = next;
+    }
+    state->pool.terminals = NULL;
+    state->pool.num_idle = 0;
+
+    if (state->pool.timerfd >= 0) {
+        xdptf_loop_remove(state, state->pool.timerfd);
+        close(state->pool.timerfd);
+        state->pool.timerfd = -1;
+    }
+}
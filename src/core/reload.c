@@ -0,0 +1,214 @@
+#include "reload.h"
+#include "config.h"
+#include "logger.h"
+#include "xdptf.h"
+#include <errno.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+// editors either rewrite the file or move a new one over it
+#define DIR_EVENTS                                                             \
+    (IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_CREATE |    \
+     IN_ONLYDIR)
+// the file itself is watched as well, to follow it through a symlink
+#define FILE_EVENTS (IN_CLOSE_WRITE | IN_DELETE_SELF | IN_MOVE_SELF)
+
+static const char *base_name(const char *path)
+{
+    const char *slash = strrchr(path, '/');
+    return slash ? slash + 1 : path;
+}
+
+// whether name, in one of the watched directories or their parents, could
+// change which config is loaded
+static bool is_config_name(struct xdptf_reload *reload, const char *name)
+{
+    for (int i = 0; i < reload->num_dirs; i++) {
+        if (strcmp(name, base_name(reload->dirs[i])) == 0) {
+            return true;
+        }
+    }
+
+    if (reload->configfile) {
+        return strcmp(name, base_name(reload->configfile)) == 0;
+    }
+    if (strcmp(name, "config") == 0) {
+        return true;
+    }
+    // see get_config_path
+    const char *desktops = getenv("XDG_CURRENT_DESKTOP");
+    size_t len = strlen(name);
+    for (const char *ptr = desktops; ptr && *ptr;) {
+        const char *end = strchr(ptr, ':');
+        size_t n = end ? (size_t)(end - ptr) : strlen(ptr);
+        if (n == len && strncmp(ptr, name, len) == 0) {
+            return true;
+        }
+        ptr = end ? end + 1 : ptr + n;
+    }
+    return false;
+}
+
+static void watch_dir(int fd, const char *dir)
+{
+    if (inotify_add_watch(fd, dir, DIR_EVENTS) >= 0) {
+        return;
+    }
+    if (errno != ENOENT) {
+        logprint(DEBUG, "reload: could not watch '%s': %s", dir,
+                 strerror(errno));
+        return;
+    }
+
+    // wait for it to be created; its parent may be watched already
+    char *parent = strdup(dir);
+    char *slash = strrchr(parent, '/');
+    if (slash && slash != parent) {
+        *slash = '\0';
+        inotify_add_watch(fd, parent,
+                          IN_CREATE | IN_MOVED_TO | IN_ONLYDIR | IN_MASK_ADD);
+    }
+    free(parent);
+}
+
+// adding a watch again only updates it, so this is redone after each reload
+static void watch_config(struct xdptf_reload *reload)
+{
+    for (int i = 0; i < reload->num_dirs; i++) {
+        watch_dir(reload->fd, reload->dirs[i]);
+    }
+
+    int wd = -1;
+    if (reload->path) {
+        wd = inotify_add_watch(reload->fd, reload->path, FILE_EVENTS);
+    }
+    if (reload->file_wd >= 0 && reload->file_wd != wd) {
+        inotify_rm_watch(reload->fd, reload->file_wd);
+    }
+    reload->file_wd = wd;
+}
+
+// requests that are running keep the config they started with, it is freed
+// once the last of them is done
+static void reload_config(struct xdptf_state *state)
+{
+    struct xdptf_reload *reload = &state->reload;
+    char *path = reload->configfile ? strdup(reload->configfile) : NULL;
+    struct config_filechooser *config =
+        calloc(1, sizeof(struct config_filechooser));
+    if (!init_config(&path, config)) {
+        // most likely caught halfway through an edit, the next change
+        // brings another reload
+        logprint(WARN, "reload: keeping the current config");
+        config_unref(config);
+        free(path);
+        watch_config(reload);
+        return;
+    }
+    logprint(INFO, "reload: loaded %s", path);
+    print_config(DEBUG, config);
+
+    config_unref(state->config);
+    state->config = config;
+    free(reload->path);
+    reload->path = path;
+    watch_config(reload);
+}
+
+static int handle_change(struct xdptf_state *state, int fd, short revents,
+                         void *data)
+{
+    struct xdptf_reload *reload = &state->reload;
+    char buf[4096]
+        __attribute__((aligned(__alignof__(struct inotify_event))));
+    bool changed = false;
+
+    // one reload for everything that happened since the last one
+    for (;;) {
+        ssize_t len = read(fd, buf, sizeof(buf));
+        if (len < 0) {
+            if (errno == EAGAIN) {
+                break;
+            }
+            return -errno;
+        }
+
+        for (char *ptr = buf; ptr < buf + len;) {
+            struct inotify_event *event = (struct inotify_event *)ptr;
+            ptr += sizeof(struct inotify_event) + event->len;
+            // a new file is only complete once it is closed
+            if ((event->mask & (IN_CREATE | IN_ISDIR)) == IN_CREATE) {
+                continue;
+            }
+            if (event->wd == reload->file_wd ||
+                (event->mask & IN_Q_OVERFLOW) ||
+                (event->len > 0 && is_config_name(reload, event->name))) {
+                changed = true;
+            }
+        }
+    }
+
+    if (changed) {
+        reload_config(state);
+    }
+    return 0;
+}
+
+void xdptf_reload_init(struct xdptf_state *state, char *configfile,
+                       char *path)
+{
+    struct xdptf_reload *reload = &state->reload;
+    *reload = (struct xdptf_reload){
+        .fd = -1,
+        .configfile = configfile,
+        .path = path,
+        .file_wd = -1,
+    };
+
+    if (configfile) {
+        char *dir = strdup(configfile);
+        char *slash = strrchr(dir, '/');
+        if (slash == NULL) {
+            strcpy(dir, ".");
+        } else if (slash == dir) {
+            slash[1] = '\0';
+        } else {
+            *slash = '\0';
+        }
+        reload->dirs[0] = dir;
+        reload->num_dirs = 1;
+    } else {
+        reload->num_dirs = get_config_dirs(reload->dirs);
+    }
+
+    reload->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (reload->fd < 0 ||
+        xdptf_loop_add(state, reload->fd, POLLIN, handle_change, NULL) < 0) {
+        logprint(WARN, "reload: could not watch the config: %s",
+                 strerror(errno));
+        if (reload->fd >= 0) {
+            close(reload->fd);
+            reload->fd = -1;
+        }
+        return;
+    }
+    watch_config(reload);
+}
+
+void xdptf_reload_finish(struct xdptf_state *state)
+{
+    struct xdptf_reload *reload = &state->reload;
+    if (reload->fd >= 0) {
+        xdptf_loop_remove(state, reload->fd);
+        close(reload->fd);
+    }
+    for (int i = 0; i < reload->num_dirs; i++) {
+        free(reload->dirs[i]);
+    }
+    free(reload->configfile);
+    free(reload->path);
+}
@@ -1,18 +1,148 @@
+#define _GNU_SOURCE
 #include "logger.h"
 #include "xdptf.h"
 #include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+
+#define REGISTRY_MIN_BUCKETS 16
+// how often a child is checked on without a pidfd
+#define CHILD_POLL_MSEC 100
+// how long a closed chooser gets to exit at shutdown before it is killed
+#define CANCEL_GRACE_MSEC 1000
 
 static const char interface_name[] = "org.freedesktop.impl.portal.Request";
 
+// FNV-1a
+static uint64_t hash_handle(const char *handle)
+{
+    uint64_t hash = 0xcbf29ce484222325;
+    for (const unsigned char *ptr = (const unsigned char *)handle; *ptr;
+         ptr++) {
+        hash ^= *ptr;
+        hash *= 0x100000001b3;
+    }
+    return hash;
+}
+
+static int registry_resize(struct xdptf_registry *registry, size_t num_buckets)
+{
+    struct xdptf_request **buckets =
+        calloc(num_buckets, sizeof(struct xdptf_request *));
+    if (buckets == NULL) {
+        return -ENOMEM;
+    }
+
+    for (size_t i = 0; i < registry->num_buckets; i++) {
+        struct xdptf_request *req = registry->buckets[i];
+        while (req) {
+            struct xdptf_request *next = req->next;
+            size_t bucket = hash_handle(req->handle) & (num_buckets - 1);
+            req->next = buckets[bucket];
+            buckets[bucket] = req;
+            req = next;
+        }
+    }
+
+    free(registry->buckets);
+    registry->buckets = buckets;
+    registry->num_buckets = num_buckets;
+    return 0;
+}
+
+static int registry_add(struct xdptf_registry *registry,
+                        struct xdptf_request *req)
+{
+    if (registry->num_requests >= registry->num_buckets) {
+        size_t num_buckets = registry->num_buckets
+                                 ? 2 * registry->num_buckets
+                                 : REGISTRY_MIN_BUCKETS;
+        int ret = registry_resize(registry, num_buckets);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+
+    size_t bucket = hash_handle(req->handle) & (registry->num_buckets - 1);
+    req->next = registry->buckets[bucket];
+    registry->buckets[bucket] = req;
+    registry->num_requests++;
+    req->registered = true;
+    return 0;
+}
+
+// unlinks req from wherever it is, its bucket or the cancelled list
+static void registry_remove(struct xdptf_registry *registry,
+                            struct xdptf_request *req)
+{
+    struct xdptf_request **next;
+    if (req->registered) {
+        size_t bucket = hash_handle(req->handle) & (registry->num_buckets - 1);
+        next = &registry->buckets[bucket];
+    } else if (req->cancelled) {
+        next = &registry->cancelled;
+    } else {
+        return;
+    }
+
+    while (*next) {
+        if (*next == req) {
+            *next = req->next;
+            if (req->registered) {
+                registry->num_requests--;
+            }
+            if (registry->num_requests == 0 && registry->cancelled == NULL) {
+                registry->idle_since_usec = xdptf_now_usec();
+            }
+            break;
+        }
+        next = &(*next)->next;
+    }
+    req->next = NULL;
+    req->registered = false;
+}
+
+struct xdptf_request *xdptf_request_lookup(struct xdptf_state *state,
+                                           const char *handle)
+{
+    struct xdptf_registry *registry = &state->requests;
+    if (registry->num_buckets == 0) {
+        return NULL;
+    }
+
+    size_t bucket = hash_handle(handle) & (registry->num_buckets - 1);
+    for (struct xdptf_request *req = registry->buckets[bucket]; req;
+         req = req->next) {
+        if (strcmp(req->handle, handle) == 0) {
+            return req;
+        }
+    }
+    return NULL;
+}
+
 static int method_close(sd_bus_message *msg, void *data,
                         sd_bus_error *ret_error)
 {
-    struct xdptf_request *req = data;
+    struct xdptf_state *state = data;
     int ret = 0;
     logprint(INFO, "dbus: request closed");
 
+    struct xdptf_request *req =
+        xdptf_request_lookup(state, sd_bus_message_get_path(msg));
+
     sd_bus_message *reply = NULL;
     ret = sd_bus_message_new_method_return(msg, &reply);
     if (ret < 0) {
@@ -26,7 +156,7 @@ static int method_close(sd_bus_message *msg, void *data,
 
     sd_bus_message_unref(reply);
 
-    xdptf_request_destroy(req);
+    xdptf_request_cancel(req);
 
     return 0;
 }
@@ -36,20 +166,53 @@ static const sd_bus_vtable request_vtable[] = {
     SD_BUS_METHOD("Close", "", "", method_close, SD_BUS_VTABLE_UNPRIVILEGED),
     SD_BUS_VTABLE_END};
 
-struct xdptf_request *xdptf_request_create(sd_bus *bus, const char *object_path)
+struct xdptf_request *xdptf_request_create(struct xdptf_state *state,
+                                           sd_bus_message *msg,
+                                           const char *object_path,
+                                           const char *app_id)
 {
     struct xdptf_request *req = calloc(1, sizeof(struct xdptf_request));
+    if (req == NULL) {
+        return NULL;
+    }
+    req->handle = xdptf_arena_strdup(&req->arena, object_path);
+    req->app_id = xdptf_arena_strdup(&req->arena, app_id ? app_id : "");
+    if (req->handle == NULL || req->app_id == NULL) {
+        xdptf_arena_reset(&req->arena);
+        free(req);
+        return NULL;
+    }
+    req->state = state;
+    req->config = config_ref(state->config);
+    req->pid = -1;
+    req->child_fd = -1;
+
+    req->start_usec = xdptf_now_usec();
 
     int ret;
-    ret = sd_bus_add_object_vtable(bus, &req->slot, object_path, interface_name,
-                                   request_vtable, NULL);
+    ret = sd_bus_add_object_vtable(sd_bus_message_get_bus(msg), &req->slot,
+                                   object_path, interface_name, request_vtable,
+                                   state);
     if (ret < 0) {
+        config_unref(req->config);
+        xdptf_arena_reset(&req->arena);
         free(req);
         logprint(ERROR, "dbus: sd_bus_add_object_vtable failed: %s",
-                 strerror(-errno));
+                 strerror(-ret));
         return NULL;
     }
 
+    ret = registry_add(&state->requests, req);
+    if (ret < 0) {
+        sd_bus_slot_unref(req->slot);
+        config_unref(req->config);
+        xdptf_arena_reset(&req->arena);
+        free(req);
+        return NULL;
+    }
+    req->msg = sd_bus_message_ref(msg);
+    req->trace_id = xdptf_trace_request(req->handle, req->app_id);
+
     return req;
 }
 
@@ -58,6 +221,283 @@ void xdptf_request_destroy(struct xdptf_request *req)
     if (req == NULL) {
         return;
     }
+    registry_remove(&req->state->requests, req);
+    if (req->child_fd >= 0) {
+        xdptf_loop_remove(req->state, req->child_fd);
+        close(req->child_fd);
+    }
+    xdptf_pool_release(req->state, req->terminal);
+    if (req->free_data) {
+        req->free_data(req->data);
+    }
+    xdptf_result_destroy(req->result);
+    sd_bus_message_unref(req->msg);
     sd_bus_slot_unref(req->slot);
+    config_unref(req->config);
+    xdptf_arena_reset(&req->arena);
     free(req);
 }
+
+void xdptf_request_record(struct xdptf_request *req, enum xdptf_phase phase,
+                          uint64_t start_usec)
+{
+    uint64_t now = xdptf_now_usec();
+    xdptf_stats_record(&req->state->stats, phase, now - start_usec);
+    xdptf_trace_span(req->trace_id, xdptf_phase_name(phase), start_usec, now,
+                     0);
+}
+
+void xdptf_request_cancel(struct xdptf_request *req)
+{
+    if (req == NULL || req->cancelled) {
+        return;
+    }
+    req->cancelled = true;
+
+    if (req->pid > 0) {
+        logprint(DEBUG, "request: terminating process group %d", req->pid);
+        if (kill(-req->pid, SIGTERM) == -1 && errno != ESRCH) {
+            logprint(WARN, "request: could not terminate %d: %s", req->pid,
+                     strerror(errno));
+        }
+    }
+
+    if (req->msg) {
+        int ret = sd_bus_reply_method_return(req->msg, "ua{sv}",
+                                             PORTAL_RESPONSE_CANCELLED, 0);
+        if (ret < 0) {
+            logprint(ERROR, "dbus: failed to reply to closed request: %s",
+                     strerror(-ret));
+        }
+        req->msg = sd_bus_message_unref(req->msg);
+    }
+
+    if (req->pid <= 0) {
+        xdptf_request_destroy(req);
+        return;
+    }
+
+    // release everything now; only the child is left to be reaped, after
+    // which on_exit sees req->cancelled and just cleans up. Until then req
+    // is kept on the cancelled list, so it is not lost at shutdown
+    struct xdptf_registry *registry = &req->state->requests;
+    registry_remove(registry, req);
+    req->next = registry->cancelled;
+    registry->cancelled = req;
+    xdptf_pool_release(req->state, req->terminal);
+    req->terminal = NULL;
+    req->slot = sd_bus_slot_unref(req->slot);
+    xdptf_result_destroy(req->result);
+    req->result = NULL;
+}
+
+static void child_exited(struct xdptf_request *req, int status)
+{
+    logprint(TRACE, "request: child %d exited with status %d", req->pid,
+             status);
+    uint64_t now = xdptf_now_usec();
+    xdptf_stats_record(&req->state->stats, PHASE_CHOOSER,
+                       now - req->spawn_usec);
+    xdptf_trace_span(req->trace_id, xdptf_phase_name(PHASE_CHOOSER),
+                     req->spawn_usec, now, req->pid);
+
+    xdptf_loop_remove(req->state, req->child_fd);
+    close(req->child_fd);
+    req->child_fd = -1;
+    req->pid = -1;
+
+    // on_exit owns req from here on and is expected to destroy it
+    req->on_exit(req, status);
+}
+
+static int handle_child(struct xdptf_state *state, int fd, short revents,
+                        void *data)
+{
+    struct xdptf_request *req = data;
+    int status;
+    if (xdptf_child_reap(fd, req->pid, &status)) {
+        child_exited(req, status);
+    }
+    return 0;
+}
+
+// gives a closed chooser CANCEL_GRACE_MSEC to go after the SIGTERM from
+// xdptf_request_cancel, then kills it
+static void reap_cancelled(struct xdptf_request *req)
+{
+    int status = 0;
+    pid_t pid = 0;
+    for (int i = 0; i < CANCEL_GRACE_MSEC / 10 && pid == 0; i++) {
+        pid = waitpid(req->pid, &status, WNOHANG);
+        if (pid == 0) {
+            nanosleep(&(struct timespec){.tv_nsec = 10000000}, NULL);
+        }
+    }
+    if (pid == 0) {
+        logprint(WARN, "request: killing process group %d", req->pid);
+        kill(-req->pid, SIGKILL);
+        pid = waitpid(req->pid, &status, 0);
+    }
+    if (pid == -1) {
+        status = -1;
+    }
+    child_exited(req, status);
+}
+
+void xdptf_request_cancel_all(struct xdptf_state *state)
+{
+    struct xdptf_registry *registry = &state->requests;
+    for (size_t i = 0; i < registry->num_buckets; i++) {
+        while (registry->buckets[i]) {
+            // moves it to the cancelled list if its chooser is running
+            xdptf_request_cancel(registry->buckets[i]);
+        }
+    }
+    free(registry->buckets);
+    registry->buckets = NULL;
+    registry->num_buckets = 0;
+
+    // on_exit destroys each, which unlinks it
+    while (registry->cancelled) {
+        reap_cancelled(registry->cancelled);
+    }
+}
+
+bool xdptf_request_idle(const struct xdptf_state *state)
+{
+    return state->requests.num_requests == 0 &&
+           state->requests.cancelled == NULL;
+}
+
+int xdptf_spawn(const char *path, char *const argv[], char *const envp[],
+                pid_t *pid)
+{
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    // own process group, so the whole tree can be signalled at once
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP);
+    posix_spawnattr_setpgroup(&attr, 0);
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+#if defined(__GLIBC__) && __GLIBC_PREREQ(2, 34)
+    // our fds are all CLOEXEC, but a library may have leaked one; the child
+    // only ever gets stdio
+    posix_spawn_file_actions_addclosefrom_np(&actions, 3);
+#endif
+
+    int ret = posix_spawn(pid, path, &actions, &attr, argv, envp);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    if (ret != 0) {
+        logprint(ERROR, "request: could not spawn '%s': %s", path,
+                 strerror(ret));
+        *pid = -1;
+        return -ret;
+    }
+    logprint(TRACE, "request: spawned child %d", *pid);
+    return 0;
+}
+
+int xdptf_spawn_shell(const char *cmd, char *const envp[], pid_t *pid)
+{
+    char *const argv[] = {"sh", "-c", (char *)cmd, NULL};
+    return xdptf_spawn("/bin/sh", argv, envp, pid);
+}
+
+static int pidfd_open(pid_t pid)
+{
+    return syscall(SYS_pidfd_open, pid, 0);
+}
+
+// the child is only ever waited for from the loop, so the bus is served
+// while it runs
+int xdptf_watch_child(struct xdptf_state *state, pid_t pid,
+                      xdptf_loop_handler handler, void *data)
+{
+    int fd = pidfd_open(pid);
+    if (fd >= 0) {
+        if (xdptf_loop_add(state, fd, POLLIN, handler, data) == 0) {
+            return fd;
+        }
+        close(fd);
+    } else {
+        // kernels older than 5.3
+        logprint(DEBUG, "request: pidfd_open failed: %s; polling for child",
+                 strerror(errno));
+    }
+
+    struct itimerspec spec = {
+        .it_interval = {.tv_nsec = CHILD_POLL_MSEC * 1000000},
+        .it_value = {.tv_nsec = CHILD_POLL_MSEC * 1000000},
+    };
+    fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (fd < 0) {
+        return -errno;
+    }
+    int ret = timerfd_settime(fd, 0, &spec, NULL) < 0 ? -errno : 0;
+    if (ret == 0) {
+        ret = xdptf_loop_add(state, fd, POLLIN, handler, data);
+    }
+    if (ret < 0) {
+        close(fd);
+        return ret;
+    }
+    return fd;
+}
+
+int xdptf_child_reap(int fd, pid_t pid, int *status)
+{
+    // drains the timer; a pidfd cannot be read, which fails harmlessly
+    uint64_t expirations;
+    ssize_t n = read(fd, &expirations, sizeof(expirations));
+    (void)n;
+
+    // a readable pidfd means the child is waiting to be reaped already
+    *status = 0;
+    pid_t ret;
+    do {
+        ret = waitpid(pid, status, WNOHANG);
+    } while (ret == -1 && errno == EINTR);
+    if (ret == 0) {
+        return 0;
+    }
+    if (ret == -1) {
+        logprint(ERROR, "request: waitpid failed for pid %d: %s", pid,
+                 strerror(errno));
+        *status = -1;
+    }
+    return 1;
+}
+
+int xdptf_request_spawn(struct xdptf_state *state, struct xdptf_request *req,
+                        const char *path, char *const argv[],
+                        char *const envp[],
+                        xdptf_request_exit_handler on_exit,
+                        uint64_t start_usec)
+{
+    req->on_exit = on_exit;
+
+    int ret = xdptf_spawn(path, argv, envp, &req->pid);
+    if (ret < 0) {
+        return ret;
+    }
+    req->spawn_usec = xdptf_now_usec();
+    xdptf_stats_record(&state->stats, PHASE_SPAWN,
+                       req->spawn_usec - start_usec);
+    xdptf_trace_span(req->trace_id, xdptf_phase_name(PHASE_SPAWN), start_usec,
+                     req->spawn_usec, 0);
+
+    ret = xdptf_watch_child(state, req->pid, handle_child, req);
+    if (ret < 0) {
+        // a chooser nobody waits for would never be answered
+        logprint(ERROR, "request: could not watch child %d: %s", req->pid,
+                 strerror(-ret));
+        kill(-req->pid, SIGKILL);
+        waitpid(req->pid, NULL, 0);
+        req->pid = -1;
+        return ret;
+    }
+    req->child_fd = ret;
+    return 0;
+}
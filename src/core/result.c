@@ -0,0 +1,309 @@
+#define _GNU_SOURCE
+#include "result.h"
+#include "logger.h"
+#include "xdptf.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define PATH_PORTAL_BASE "/tmp/termfilechooser"
+
+// derive a file name component from the request handle, e.g.
+// /org/freedesktop/portal/desktop/request/1_42/gtk123 -> 1_42_gtk123
+static char *handle_to_key(const char *handle)
+{
+    const char *marker = "/request/";
+    const char *start = strstr(handle, marker);
+    start = start ? start + strlen(marker) : handle;
+
+    char *key = strdup(start);
+    for (char *ptr = key; *ptr; ptr++) {
+        if (!((*ptr >= 'a' && *ptr <= 'z') || (*ptr >= 'A' && *ptr <= 'Z') ||
+              (*ptr >= '0' && *ptr <= '9') || *ptr == '_')) {
+            *ptr = '_';
+        }
+    }
+    return key;
+}
+
+static char *create_exclusive(const char *key, const char *suffix)
+{
+    uid_t uid = getuid();
+    size_t path_size = 1 + snprintf(NULL, 0, "%s-%u-%s%s", PATH_PORTAL_BASE,
+                                    uid, key, suffix);
+    char *path = malloc(path_size);
+    snprintf(path, path_size, "%s-%u-%s%s", PATH_PORTAL_BASE, uid, key, suffix);
+
+    // create it exclusively, so a stale file or a planted symlink from
+    // another user is never written through
+    int fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (fd == -1 && errno == EEXIST) {
+        logprint(DEBUG, "result: removing stale '%s'", path);
+        unlink(path);
+        fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    }
+    if (fd == -1) {
+        logprint(ERROR, "result: could not create '%s': %s", path,
+                 strerror(errno));
+        free(path);
+        return NULL;
+    }
+    close(fd);
+    return path;
+}
+
+static int create_file(struct xdptf_result *result, const char *key)
+{
+    char *path = create_exclusive(key, ".portal");
+    if (path == NULL) {
+        return -1;
+    }
+
+    result->channel = CHANNEL_FILE;
+    result->path = path;
+    return 0;
+}
+
+static int create_memfd(struct xdptf_result *result, const char *key)
+{
+    int fd = memfd_create(key, MFD_CLOEXEC);
+    if (fd == -1) {
+        logprint(WARN, "result: memfd_create failed: %s", strerror(errno));
+        return -1;
+    }
+
+    // the wrapper reopens the memfd through our fd table, so it never has to
+    // inherit the descriptor itself
+    size_t path_size = 1 + snprintf(NULL, 0, "/proc/%d/fd/%d", getpid(), fd);
+    result->path = malloc(path_size);
+    snprintf(result->path, path_size, "/proc/%d/fd/%d", getpid(), fd);
+    result->channel = CHANNEL_MEMFD;
+    result->fd = fd;
+    return 0;
+}
+
+static int drain_fifo(struct xdptf_result *result)
+{
+    while (1) {
+        if (result->len == result->capacity) {
+            size_t capacity = result->capacity ? 2 * result->capacity : 4096;
+            char *buf = realloc(result->buf, capacity);
+            if (buf == NULL) {
+                return -ENOMEM;
+            }
+            result->buf = buf;
+            result->capacity = capacity;
+        }
+
+        ssize_t nread = read(result->fd, result->buf + result->len,
+                             result->capacity - result->len);
+        if (nread > 0) {
+            result->len += nread;
+        } else if (nread == 0 || errno == EAGAIN) {
+            return 0;
+        } else if (errno != EINTR) {
+            return -errno;
+        }
+    }
+}
+
+static int handle_fifo(struct xdptf_state *state, int fd, short revents,
+                       void *data)
+{
+    // keep the pipe empty while the chooser runs, so large selections never
+    // block the writer
+    return drain_fifo(data);
+}
+
+static int create_fifo(struct xdptf_result *result, struct xdptf_state *state,
+                       const char *key)
+{
+    const char *runtime_dir = getenv("XDG_RUNTIME_DIR");
+    if (runtime_dir == NULL || *runtime_dir == '\0') {
+        logprint(WARN, "result: XDG_RUNTIME_DIR is not set");
+        return -1;
+    }
+
+    size_t path_size =
+        1 + snprintf(NULL, 0, "%s/termfilechooser-%s.fifo", runtime_dir, key);
+    char *path = malloc(path_size);
+    snprintf(path, path_size, "%s/termfilechooser-%s.fifo", runtime_dir, key);
+
+    int ret = mkfifo(path, 0600);
+    if (ret == -1 && errno == EEXIST) {
+        logprint(DEBUG, "result: removing stale '%s'", path);
+        unlink(path);
+        ret = mkfifo(path, 0600);
+    }
+    if (ret == -1) {
+        logprint(WARN, "result: could not create '%s': %s", path,
+                 strerror(errno));
+        free(path);
+        return -1;
+    }
+
+    // hold our own write end, so the read end never sees a hangup between
+    // writers and the chooser never blocks opening the fifo
+    result->fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    result->wfd = open(path, O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+    if (result->fd == -1 || result->wfd == -1 ||
+        xdptf_loop_add(state, result->fd, POLLIN, handle_fifo, result) < 0) {
+        logprint(WARN, "result: could not open '%s': %s", path,
+                 strerror(errno));
+        if (result->fd != -1) {
+            close(result->fd);
+        }
+        if (result->wfd != -1) {
+            close(result->wfd);
+        }
+        result->fd = result->wfd = -1;
+        unlink(path);
+        free(path);
+        return -1;
+    }
+
+    result->channel = CHANNEL_FIFO;
+    result->path = path;
+    result->state = state;
+    return 0;
+}
+
+struct xdptf_result *xdptf_result_create(struct xdptf_state *state,
+                                         enum Channel channel,
+                                         const char *handle)
+{
+    struct xdptf_result *result = calloc(1, sizeof(struct xdptf_result));
+    result->fd = -1;
+    result->wfd = -1;
+
+    char *key = handle_to_key(handle);
+    int ret = -1;
+    switch (channel) {
+        case CHANNEL_MEMFD:
+            ret = create_memfd(result, key);
+            break;
+        case CHANNEL_FIFO:
+            ret = create_fifo(result, state, key);
+            break;
+        case CHANNEL_FILE:
+            break;
+    }
+    if (ret < 0) {
+        if (channel != CHANNEL_FILE) {
+            logprint(WARN, "result: falling back to a result file");
+        }
+        ret = create_file(result, key);
+    }
+    free(key);
+
+    if (ret < 0) {
+        free(result);
+        return NULL;
+    }
+
+    logprint(TRACE, "result: created '%s'", result->path);
+    return result;
+}
+
+char *xdptf_result_create_side_file(const char *handle, const char *suffix)
+{
+    char *key = handle_to_key(handle);
+    char *path = create_exclusive(key, suffix);
+    free(key);
+    return path;
+}
+
+static int read_fd(int fd, char **data, size_t *size)
+{
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        return -errno;
+    }
+
+    *size = st.st_size;
+    *data = malloc(1 + *size);
+    size_t total = 0;
+    while (total < *size) {
+        ssize_t nread = pread(fd, *data + total, *size - total, total);
+        if (nread == 0) {
+            break;
+        } else if (nread == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            int ret = -errno;
+            free(*data);
+            *data = NULL;
+            return ret;
+        }
+        total += nread;
+    }
+    *size = total;
+    (*data)[total] = '\0';
+    return 0;
+}
+
+int xdptf_result_read(struct xdptf_result *result, char **data, size_t *size)
+{
+    int ret = 0;
+    switch (result->channel) {
+        case CHANNEL_FILE: {
+            int fd = open(result->path, O_RDONLY | O_CLOEXEC);
+            if (fd == -1) {
+                ret = -errno;
+                break;
+            }
+            ret = read_fd(fd, data, size);
+            close(fd);
+            break;
+        }
+        case CHANNEL_MEMFD:
+            ret = read_fd(result->fd, data, size);
+            break;
+        case CHANNEL_FIFO:
+            ret = drain_fifo(result);
+            if (ret < 0) {
+                break;
+            }
+            *size = result->len;
+            *data = malloc(1 + result->len);
+            memcpy(*data, result->buf, result->len);
+            (*data)[result->len] = '\0';
+            break;
+    }
+
+    if (ret < 0) {
+        logprint(ERROR, "result: failed to read '%s': %s", result->path,
+                 strerror(-ret));
+    }
+    return ret;
+}
+
+void xdptf_result_destroy(struct xdptf_result *result)
+{
+    if (result == NULL) {
+        return;
+    }
+    switch (result->channel) {
+        case CHANNEL_FILE:
+            remove(result->path);
+            break;
+        case CHANNEL_MEMFD:
+            close(result->fd);
+            break;
+        case CHANNEL_FIFO:
+            xdptf_loop_remove(result->state, result->fd);
+            close(result->fd);
+            close(result->wfd);
+            unlink(result->path);
+            break;
+    }
+    free(result->buf);
+    free(result->path);
+    free(result);
+}
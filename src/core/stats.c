@@ -0,0 +1,255 @@
+#include "stats.h"
+#include "logger.h"
+#include "xdptf.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// distinct app ids tracked before the rest is lumped together
+#define STATS_MAX_APPS 128
+#define STATS_OTHER_APPS "(other)"
+
+static const char object_path[] =
+    "/org/freedesktop/portal/desktop/termfilechooser";
+static const char interface_name[] =
+    "org.freedesktop.impl.portal.desktop.termfilechooser.Stats";
+
+static const char *const phase_names[PHASE_COUNT] = {
+    [PHASE_DECODE] = "decode",
+    [PHASE_CURRENT_FOLDER] = "current_folder",
+    [PHASE_HELP_FILE] = "help_file",
+    [PHASE_SPAWN] = "spawn",
+    [PHASE_CHOOSER] = "chooser",
+    [PHASE_PARSE] = "parse",
+    [PHASE_REPLY] = "reply",
+    [PHASE_TOTAL] = "total",
+};
+
+uint64_t xdptf_now_usec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+const char *xdptf_phase_name(enum xdptf_phase phase)
+{
+    return phase_names[phase];
+}
+
+static int bucket_index(uint64_t usec)
+{
+    if (usec < 16) {
+        return usec;
+    }
+    int exponent = 63 - __builtin_clzll(usec);
+    int sub = (usec >> (exponent - 3)) & 7;
+    int index = 16 + (exponent - 4) * 8 + sub;
+    return index < STATS_NUM_BUCKETS ? index : STATS_NUM_BUCKETS - 1;
+}
+
+// largest value that still falls into the bucket
+static uint64_t bucket_upper(int index)
+{
+    if (index < 16) {
+        return index;
+    }
+    int exponent = 4 + (index - 16) / 8;
+    int sub = (index - 16) % 8;
+    return ((uint64_t)(8 + sub + 1) << (exponent - 3)) - 1;
+}
+
+void xdptf_stats_record(struct xdptf_stats *stats, enum xdptf_phase phase,
+                        uint64_t usec)
+{
+    struct xdptf_histogram *histogram = &stats->phases[phase];
+    histogram->count++;
+    histogram->buckets[bucket_index(usec)]++;
+    if (usec > histogram->max_usec) {
+        histogram->max_usec = usec;
+    }
+    logprint(TRACE, "stats: %s took %luus", phase_names[phase],
+             (unsigned long)usec);
+}
+
+uint64_t xdptf_histogram_percentile(const struct xdptf_histogram *histogram,
+                                    double quantile)
+{
+    if (histogram->count == 0) {
+        return 0;
+    }
+
+    uint64_t rank = quantile * histogram->count;
+    if (rank < quantile * histogram->count || rank == 0) {
+        rank++;
+    }
+    uint64_t seen = 0;
+    for (int i = 0; i < STATS_NUM_BUCKETS; i++) {
+        seen += histogram->buckets[i];
+        if (seen >= rank) {
+            uint64_t upper = bucket_upper(i);
+            return upper < histogram->max_usec ? upper : histogram->max_usec;
+        }
+    }
+    return histogram->max_usec;
+}
+
+void xdptf_stats_record_request(struct xdptf_stats *stats, const char *app_id,
+                                bool failed)
+{
+    if (app_id == NULL) {
+        app_id = "";
+    }
+
+    struct xdptf_app_stats *app = stats->apps;
+    while (app && strcmp(app->app_id, app_id) != 0) {
+        app = app->next;
+    }
+
+    if (app == NULL && stats->num_apps >= STATS_MAX_APPS) {
+        app_id = STATS_OTHER_APPS;
+        app = stats->apps;
+        while (app && strcmp(app->app_id, app_id) != 0) {
+            app = app->next;
+        }
+    }
+
+    if (app == NULL) {
+        app = calloc(1, sizeof(struct xdptf_app_stats));
+        app->app_id = strdup(app_id);
+        app->next = stats->apps;
+        stats->apps = app;
+        stats->num_apps++;
+    }
+
+    app->requests++;
+    if (failed) {
+        app->failures++;
+    }
+}
+
+static void reset_stats(struct xdptf_stats *stats)
+{
+    memset(stats->phases, 0, sizeof(stats->phases));
+    struct xdptf_app_stats *app = stats->apps;
+    while (app) {
+        struct xdptf_app_stats *next = app->next;
+        free(app->app_id);
+        free(app);
+        app = next;
+    }
+    stats->apps = NULL;
+    stats->num_apps = 0;
+}
+
+static int method_get_phases(sd_bus_message *msg, void *data,
+                             sd_bus_error *ret_error)
+{
+    struct xdptf_state *state = data;
+    sd_bus_message *reply = NULL;
+    int ret = sd_bus_message_new_method_return(msg, &reply);
+    if (ret < 0) {
+        return ret;
+    }
+
+    ret = sd_bus_message_open_container(reply, 'a', "(sttttt)");
+    if (ret < 0) {
+        goto cleanup;
+    }
+
+    for (int phase = 0; phase < PHASE_COUNT; phase++) {
+        const struct xdptf_histogram *histogram = &state->stats.phases[phase];
+        ret = sd_bus_message_append(
+            reply, "(sttttt)", phase_names[phase], histogram->count,
+            xdptf_histogram_percentile(histogram, 0.50),
+            xdptf_histogram_percentile(histogram, 0.95),
+            xdptf_histogram_percentile(histogram, 0.99), histogram->max_usec);
+        if (ret < 0) {
+            goto cleanup;
+        }
+    }
+
+    ret = sd_bus_message_close_container(reply);
+    if (ret < 0) {
+        goto cleanup;
+    }
+
+    ret = sd_bus_send(NULL, reply, NULL);
+
+cleanup:
+    sd_bus_message_unref(reply);
+    return ret;
+}
+
+static int method_get_apps(sd_bus_message *msg, void *data,
+                           sd_bus_error *ret_error)
+{
+    struct xdptf_state *state = data;
+    sd_bus_message *reply = NULL;
+    int ret = sd_bus_message_new_method_return(msg, &reply);
+    if (ret < 0) {
+        return ret;
+    }
+
+    ret = sd_bus_message_open_container(reply, 'a', "(stt)");
+    if (ret < 0) {
+        goto cleanup;
+    }
+
+    for (struct xdptf_app_stats *app = state->stats.apps; app;
+         app = app->next) {
+        ret = sd_bus_message_append(reply, "(stt)", app->app_id, app->requests,
+                                    app->failures);
+        if (ret < 0) {
+            goto cleanup;
+        }
+    }
+
+    ret = sd_bus_message_close_container(reply);
+    if (ret < 0) {
+        goto cleanup;
+    }
+
+    ret = sd_bus_send(NULL, reply, NULL);
+
+cleanup:
+    sd_bus_message_unref(reply);
+    return ret;
+}
+
+static int method_reset(sd_bus_message *msg, void *data,
+                        sd_bus_error *ret_error)
+{
+    struct xdptf_state *state = data;
+    logprint(DEBUG, "stats: reset");
+    reset_stats(&state->stats);
+    return sd_bus_reply_method_return(msg, "");
+}
+
+static const sd_bus_vtable stats_vtable[] = {
+    SD_BUS_VTABLE_START(0),
+    SD_BUS_METHOD("GetPhases", "", "a(sttttt)", method_get_phases,
+                  SD_BUS_VTABLE_UNPRIVILEGED),
+    SD_BUS_METHOD("GetApps", "", "a(stt)", method_get_apps,
+                  SD_BUS_VTABLE_UNPRIVILEGED),
+    SD_BUS_METHOD("Reset", "", "", method_reset, SD_BUS_VTABLE_UNPRIVILEGED),
+    SD_BUS_VTABLE_END};
+
+int xdptf_stats_init(struct xdptf_state *state)
+{
+    logprint(DEBUG, "dbus: init %s", interface_name);
+    int ret = sd_bus_add_object_vtable(state->bus, &state->stats.slot,
+                                       object_path, interface_name,
+                                       stats_vtable, state);
+    if (ret < 0) {
+        logprint(ERROR, "dbus: stats init failed: %s", strerror(-ret));
+    }
+    return ret;
+}
+
+void xdptf_stats_finish(struct xdptf_stats *stats)
+{
+    reset_stats(stats);
+    stats->slot = sd_bus_slot_unref(stats->slot);
+}
@@ -0,0 +1,183 @@
+#include "trace.h"
+#include "logger.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+struct trace_request {
+    uint32_t tid;
+    char *handle;
+    char *app_id;
+};
+
+// the daemon is single threaded and the signal handlers only set flags, so
+// the rings need no locking
+static struct {
+    char *path;
+    struct xdptf_trace_event *events;
+    uint64_t num_events;
+    struct trace_request requests[TRACE_MAX_REQUESTS];
+    uint32_t next_tid;
+} trace;
+
+int xdptf_trace_init(const char *path)
+{
+    trace.events = calloc(TRACE_MAX_EVENTS, sizeof(struct xdptf_trace_event));
+    if (trace.events == NULL) {
+        return -ENOMEM;
+    }
+    trace.path = strdup(path);
+    trace.next_tid = 1;
+    logprint(DEBUG, "trace: recording to '%s'", path);
+    return 0;
+}
+
+bool xdptf_trace_enabled(void)
+{
+    return trace.events != NULL;
+}
+
+uint32_t xdptf_trace_request(const char *handle, const char *app_id)
+{
+    if (!xdptf_trace_enabled()) {
+        return 0;
+    }
+
+    uint32_t tid = trace.next_tid++;
+    if (trace.next_tid == 0) {
+        trace.next_tid = 1;
+    }
+
+    struct trace_request *req = &trace.requests[tid % TRACE_MAX_REQUESTS];
+    free(req->handle);
+    free(req->app_id);
+    req->tid = tid;
+    req->handle = strdup(handle ? handle : "");
+    req->app_id = strdup(app_id ? app_id : "");
+    return tid;
+}
+
+void xdptf_trace_span(uint32_t tid, const char *name, uint64_t start_usec,
+                      uint64_t end_usec, pid_t pid)
+{
+    if (!xdptf_trace_enabled()) {
+        return;
+    }
+
+    struct xdptf_trace_event *event =
+        &trace.events[trace.num_events % TRACE_MAX_EVENTS];
+    event->name = name;
+    event->start_usec = start_usec;
+    event->dur_usec = end_usec > start_usec ? end_usec - start_usec : 0;
+    event->tid = tid;
+    event->pid = pid;
+    trace.num_events++;
+}
+
+static void write_json_string(FILE *fp, const char *str)
+{
+    fputc('"', fp);
+    for (const unsigned char *ptr = (const unsigned char *)str; *ptr; ptr++) {
+        if (*ptr == '"' || *ptr == '\\') {
+            fprintf(fp, "\\%c", *ptr);
+        } else if (*ptr < 0x20) {
+            fprintf(fp, "\\u%04x", *ptr);
+        } else {
+            fputc(*ptr, fp);
+        }
+    }
+    fputc('"', fp);
+}
+
+static void write_event(FILE *fp, const struct xdptf_trace_event *event)
+{
+    fprintf(fp, "{\"name\":");
+    write_json_string(fp, event->name);
+    fprintf(fp,
+            ",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%lu,\"dur\":%lu,"
+            "\"pid\":%d,\"tid\":%u,\"args\":{",
+            event->tid ? "request" : "daemon",
+            (unsigned long)event->start_usec, (unsigned long)event->dur_usec,
+            getpid(), event->tid);
+
+    const struct trace_request *req =
+        &trace.requests[event->tid % TRACE_MAX_REQUESTS];
+    bool comma = false;
+    if (event->tid && req->tid == event->tid) {
+        fprintf(fp, "\"handle\":");
+        write_json_string(fp, req->handle);
+        fprintf(fp, ",\"app_id\":");
+        write_json_string(fp, req->app_id);
+        comma = true;
+    }
+    if (event->pid > 0) {
+        fprintf(fp, "%s\"child\":%d", comma ? "," : "", event->pid);
+    }
+    fprintf(fp, "}}");
+}
+
+// writes everything still in the ring; the file is replaced atomically, so a
+// viewer never sees half a trace
+int xdptf_trace_flush(void)
+{
+    if (!xdptf_trace_enabled()) {
+        return 0;
+    }
+
+    size_t tmp_size = 1 + snprintf(NULL, 0, "%s.tmp", trace.path);
+    char *tmp = malloc(tmp_size);
+    snprintf(tmp, tmp_size, "%s.tmp", trace.path);
+
+    FILE *fp = fopen(tmp, "w");
+    if (fp == NULL) {
+        int ret = -errno;
+        logprint(ERROR, "trace: could not write '%s': %s", tmp,
+                 strerror(errno));
+        free(tmp);
+        return ret;
+    }
+
+    uint64_t first = trace.num_events > TRACE_MAX_EVENTS
+                         ? trace.num_events - TRACE_MAX_EVENTS
+                         : 0;
+    fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(fp, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,"
+                "\"args\":{\"name\":\"xdg-desktop-portal-termfilechooser\"}}",
+            getpid());
+    for (uint64_t i = first; i < trace.num_events; i++) {
+        fprintf(fp, ",\n");
+        write_event(fp, &trace.events[i % TRACE_MAX_EVENTS]);
+    }
+    fprintf(fp, "\n]}\n");
+
+    int ret = 0;
+    if (fclose(fp) != 0 || rename(tmp, trace.path) == -1) {
+        ret = -errno;
+        logprint(ERROR, "trace: could not write '%s': %s", trace.path,
+                 strerror(errno));
+        unlink(tmp);
+    } else {
+        logprint(DEBUG, "trace: wrote %lu spans to '%s'",
+                 (unsigned long)(trace.num_events - first), trace.path);
+    }
+    free(tmp);
+    return ret;
+}
+
+void xdptf_trace_finish(void)
+{
+    if (!xdptf_trace_enabled()) {
+        return;
+    }
+
+    xdptf_trace_flush();
+    for (int i = 0; i < TRACE_MAX_REQUESTS; i++) {
+        free(trace.requests[i].handle);
+        free(trace.requests[i].app_id);
+    }
+    free(trace.events);
+    free(trace.path);
+    memset(&trace, 0, sizeof(trace));
+}
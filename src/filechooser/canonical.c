@@ -0,0 +1,227 @@
+#define _GNU_SOURCE
+#include "canonical.h"
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TABLE_MIN_CAPACITY 16
+
+// word at a time; paths are long enough for byte-wise FNV-1a to show up
+static uint64_t hash_path(const char *path, size_t len)
+{
+    const uint64_t k = 0x9e3779b97f4a7c15;
+    uint64_t hash = len * k;
+    uint64_t word;
+    for (; len >= 8; path += 8, len -= 8) {
+        memcpy(&word, path, 8);
+        hash = (hash ^ word) * k;
+        hash ^= hash >> 29;
+    }
+    word = 0;
+    memcpy(&word, path, len);
+    hash = (hash ^ word) * k;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+// the slot holding key, or the empty one it would go into
+static struct canonical_entry *table_find(struct canonical_table *table,
+                                          const char *key, size_t len,
+                                          uint64_t hash)
+{
+    size_t mask = table->capacity - 1;
+    uint32_t tag = hash >> 32;
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        struct canonical_entry *entry = &table->entries[i];
+        if (entry->key == NULL ||
+            (entry->tag == tag && entry->len == len &&
+             memcmp(entry->key, key, len) == 0)) {
+            return entry;
+        }
+    }
+}
+
+static void table_insert(struct canonical_entry *entry, const char *key,
+                         size_t len, uint64_t hash)
+{
+    *entry = (struct canonical_entry){key, len, hash >> 32};
+}
+
+// makes room for count entries; the old array is left to the arena
+static int table_reserve(struct xdptf_arena *arena,
+                         struct canonical_table *table, size_t count)
+{
+    size_t capacity = table->capacity ? table->capacity : TABLE_MIN_CAPACITY;
+    while (capacity < count * 2) {
+        capacity *= 2;
+    }
+    if (capacity == table->capacity) {
+        return 0;
+    }
+
+    struct canonical_entry *entries =
+        xdptf_arena_alloc(arena, capacity * sizeof(struct canonical_entry));
+    if (entries == NULL) {
+        return -ENOMEM;
+    }
+    memset(entries, 0, capacity * sizeof(struct canonical_entry));
+
+    struct canonical_table grown = {entries, capacity, table->count};
+    for (size_t i = 0; i < table->capacity; i++) {
+        struct canonical_entry *entry = &table->entries[i];
+        if (entry->key) {
+            uint64_t hash = hash_path(entry->key, entry->len);
+            *table_find(&grown, entry->key, entry->len, hash) = *entry;
+        }
+    }
+    *table = grown;
+    return 0;
+}
+
+// grows the scratch buffer at *buf to hold size bytes
+static int reserve(struct xdptf_arena *arena, char **buf, size_t *buf_size,
+                   size_t size)
+{
+    if (size <= *buf_size) {
+        return 0;
+    }
+    size_t grown = *buf_size ? *buf_size : PATH_MAX;
+    while (grown < size) {
+        grown *= 2;
+    }
+    char *ptr = xdptf_arena_alloc(arena, grown);
+    if (ptr == NULL) {
+        return -ENOMEM;
+    }
+    *buf = ptr;
+    *buf_size = grown;
+    return 0;
+}
+
+// drops empty and . components and applies .. without looking at the file
+// system, so symlinks are kept as the chooser wrote them; path is absolute,
+// and dst may be path itself
+static size_t normalize(const char *path, size_t len, char *dst)
+{
+    size_t out = 0;
+    size_t pos = 0;
+    while (pos < len) {
+        while (pos < len && path[pos] == '/') {
+            pos++;
+        }
+        size_t start = pos;
+        while (pos < len && path[pos] != '/') {
+            pos++;
+        }
+        size_t n = pos - start;
+        if (n == 0 || (n == 1 && path[start] == '.')) {
+            continue;
+        }
+        if (n == 2 && path[start] == '.' && path[start + 1] == '.') {
+            while (out > 0 && dst[--out] != '/') {
+            }
+            continue;
+        }
+        dst[out++] = '/';
+        memmove(dst + out, path + start, n);
+        out += n;
+    }
+    if (out == 0) {
+        dst[out++] = '/';
+    }
+    dst[out] = '\0';
+    return out;
+}
+
+int canonical_init(struct canonical *canonical, struct xdptf_arena *arena,
+                   const char *base, size_t expected)
+{
+    *canonical = (struct canonical){.arena = arena};
+
+    const char *home = getenv("HOME");
+    if (home && home[0] == '/') {
+        canonical->home = home;
+        canonical->home_len = strlen(home);
+    }
+
+    if (base && base[0] == '/') {
+        canonical->base = base;
+        canonical->base_len = strlen(base);
+    }
+
+    if (table_reserve(arena, &canonical->seen, expected) < 0) {
+        return -ENOMEM;
+    }
+    return 0;
+}
+
+int canonical_add(struct canonical *canonical, const char *line, size_t len,
+                  const char **path, size_t *path_len)
+{
+    struct xdptf_arena *arena = canonical->arena;
+    size_t prefix_len = canonical->base_len > canonical->home_len
+                            ? canonical->base_len
+                            : canonical->home_len;
+    if (reserve(arena, &canonical->expanded, &canonical->expanded_size,
+                prefix_len + len + 3) < 0) {
+        return -ENOMEM;
+    }
+
+    // make it absolute
+    char *expanded = canonical->expanded;
+    const char *rest = line;
+    size_t n = 0;
+    if (line[0] == '~' && (len == 1 || line[1] == '/') && canonical->home) {
+        memcpy(expanded, canonical->home, canonical->home_len);
+        n = canonical->home_len;
+        expanded[n++] = '/';
+        rest++;
+    } else if (line[0] != '/') {
+        if (canonical->base == NULL) {
+            return -EINVAL;
+        }
+        memcpy(expanded, canonical->base, canonical->base_len);
+        n = canonical->base_len;
+        expanded[n++] = '/';
+    }
+    memcpy(expanded + n, rest, line + len - rest);
+    n += line + len - rest;
+
+    n = normalize(expanded, n, expanded);
+    if (n > UINT32_MAX) {
+        return -E2BIG;
+    }
+
+    uint64_t hash = hash_path(expanded, n);
+    struct canonical_entry *entry =
+        table_find(&canonical->seen, expanded, n, hash);
+    if (entry->key) {
+        return 0;
+    }
+
+    if (canonical->seen.count + 1 > canonical->seen.capacity / 2) {
+        if (table_reserve(arena, &canonical->seen, canonical->seen.count + 1) <
+            0) {
+            return -ENOMEM;
+        }
+        entry = table_find(&canonical->seen, expanded, n, hash);
+    }
+
+    // most lines are canonical already and need no copy
+    const char *key = line;
+    if (n != len || memcmp(expanded, line, len) != 0) {
+        char *copy = xdptf_arena_alloc(arena, n);
+        if (copy == NULL) {
+            return -ENOMEM;
+        }
+        key = memcpy(copy, expanded, n);
+    }
+    table_insert(entry, key, n, hash);
+    canonical->seen.count++;
+
+    *path = expanded;
+    *path_len = n;
+    return 1;
+}
@@ -1,5 +1,6 @@
 #include "config.h"
 #include "logger.h"
+#include "selection.h"
 #include "uri.h"
 #include "xdptf.h"
 #include <errno.h>
@@ -14,9 +15,6 @@
 #include <sys/wait.h>
 #include <unistd.h>
 
-#define PATH_PREFIX "file://"
-#define PATH_PORTAL_BASE "/tmp/termfilechooser"
-
 static const char instructions[] =
     "* xdg-desktop-portal-termfilechooser instructions *\n"
     "---------------------------------------------------\n\n"
@@ -38,363 +36,629 @@ static const char instructions[] =
 static const char object_path[] = "/org/freedesktop/portal/desktop";
 static const char interface_name[] = "org.freedesktop.impl.portal.FileChooser";
 
-static int exec_filechooser(void *data, bool writing, bool multiple,
-                            bool directory, char *path, char ***selected_files,
-                            size_t *num_selected_files)
+// allocated from the request's arena, as is everything it points to
+struct filechooser_call {
+    char *cmd;
+    // the folder the chooser starts in, which relative paths in its output
+    // are taken to be relative to; NULL if there is none
+    char *start_dir;
+    // SaveFile: suggested path, possibly holding the help file
+    char *save_path;
+    // run through the configured launcher instead of cmd
+    bool launcher;
+    // second output of the launcher, e.g. yazi's cwd file
+    char *side_path;
+    // OpenFile: what the selected paths have to be
+    enum selection_type type;
+    // every pattern of the filters option; OpenFile drops selected files
+    // none of them matches
+    struct filter filter;
+    // globs of the current, or else the first, filter for the wrapper
+    char *filter_patterns;
+};
+
+static struct filechooser_call *create_filechooser_call(
+    struct xdptf_request *req)
 {
-    struct xdptf_state *state = data;
-    char *cmd_script = state->config->cmd;
-    if (!cmd_script) {
-        logprint(ERROR, "filechooser: cmd not specified");
-        return -1;
+    struct filechooser_call *call =
+        xdptf_arena_alloc(&req->arena, sizeof(struct filechooser_call));
+    if (call == NULL) {
+        return NULL;
     }
+    *call = (struct filechooser_call){0};
+    filter_init(&call->filter, &req->arena);
+    return call;
+}
 
-    if (path == NULL) {
-        path = "";
+static void free_filechooser_call(void *data)
+{
+    struct filechooser_call *call = data;
+    if (call && call->side_path) {
+        unlink(call->side_path);
     }
+}
 
-    uid_t uid = getuid();
-    size_t filename_size =
-        1 + snprintf(NULL, 0, "%s-%u.portal", PATH_PORTAL_BASE, uid);
-    char *filename = malloc(filename_size);
-    snprintf(filename, filename_size, "%s-%u.portal", PATH_PORTAL_BASE, uid);
-
-    size_t str_size = 1 + snprintf(NULL, 0, "%s %d %d %d \'%s\' \'%s\' %d",
-                                   cmd_script, multiple, directory, writing,
-                                   path, filename, get_logger_level() >= 4);
-    char *cmd = malloc(str_size);
-    snprintf(cmd, str_size, "%s %d %d %d \'%s\' \'%s\' %d", cmd_script,
-             multiple, directory, writing, path, filename, get_logger_level() >= 4);
-
-    struct environment *env = state->config->env;
-
-    if (access(filename, F_OK) == 0) {
-        // clear contents
-        FILE *fp = fopen(filename, "w");
-        if (fp == NULL) {
-            logprint(ERROR, "filechooser: could not open '%s'", filename);
-            free(filename);
-            free(cmd);
-            return -1;
+// the arguments are only read until the chooser is spawned, so they point
+// into the config instead of being copied
+static char **cmd_argv(struct xdptf_request *req, bool writing, bool multiple,
+                       bool directory, const char *path)
+{
+    struct config_filechooser *config = req->config;
+    char **argv =
+        xdptf_arena_alloc(&req->arena, (config->cmd_argc + 7) * sizeof(char *));
+    if (argv == NULL) {
+        return NULL;
+    }
+    int argc = 0;
+    for (int i = 0; i < config->cmd_argc; i++) {
+        argv[argc++] = config->cmd_argv[i];
+    }
+    argv[argc++] = multiple ? "1" : "0";
+    argv[argc++] = directory ? "1" : "0";
+    argv[argc++] = writing ? "1" : "0";
+    argv[argc++] = (char *)path;
+    argv[argc++] = req->result->path;
+    argv[argc++] = get_logger_level() >= 4 ? "1" : "0";
+    argv[argc] = NULL;
+    return argv;
+}
+
+static char **launcher_argv(struct xdptf_request *req, enum LauncherMode mode,
+                            const char *path)
+{
+    struct config_filechooser *config = req->config;
+    struct launcher_spec *spec = &config->launcher;
+    struct filechooser_call *call = req->data;
+
+    if (spec->argc[mode] == 0) {
+        logprint(ERROR, "filechooser: launcher has no command for this mode");
+        return NULL;
+    }
+
+    if (launcher_uses_side_file(spec, mode)) {
+        char *side_path = xdptf_result_create_side_file(req->handle, ".cwd");
+        if (side_path == NULL) {
+            return NULL;
         }
-        if (fclose(fp) != 0) {
-            logprint(ERROR, "filechooser: could not close '%s'", filename);
-            free(filename);
-            free(cmd);
-            return -1;
+        call->side_path = xdptf_arena_strdup(&req->arena, side_path);
+        if (call->side_path == NULL) {
+            unlink(side_path);
+        }
+        free(side_path);
+        if (call->side_path == NULL) {
+            return NULL;
         }
     }
 
-    for (int i = 0, ret = 0; i < env->num_vars; i++) {
-        logprint(TRACE, "filechooser: setting env: %s=%s", env->vars[i].name,
-                 env->vars[i].value);
-        ret = setenv(env->vars[i].name, env->vars[i].value, 1);
-        if (ret) {
-            logprint(WARN, "filechooser: could not set env '%s': %s",
-                     env->vars[i].name, strerror(errno));
+    char *const attach[] = {"pool-shell.sh", "attach",
+                            req->terminal ? req->terminal->fifo : NULL,
+                            req->terminal ? req->terminal->done_fifo : NULL};
+    char *const *prefix = NULL;
+    char **words = NULL;
+    int prefix_len = 0;
+    if (req->terminal) {
+        prefix = attach;
+        prefix_len = sizeof(attach) / sizeof(attach[0]);
+    } else if (spec->terminal) {
+        const char *termcmd = get_config_env(config, "TERMCMD");
+        if (termcmd == NULL) {
+            termcmd = DEFAULT_TERMCMD;
+        }
+        if (split_words(termcmd, &words, &prefix_len) < 0) {
+            logprint(ERROR, "filechooser: could not parse TERMCMD '%s'",
+                     termcmd);
+            return NULL;
         }
+        prefix = words;
     }
 
-    logprint(TRACE, "filechooser: executing command '%s'", cmd);
-    int ret = system(cmd);
-    if (ret) {
-        if (ret == -1) {
-            logprint(ERROR, "filechooser: could not execute '%s': %s", cmd,
-                     strerror(errno));
-        } else {
-            // FIX: properly get exit code
-            logprint(ERROR, "filechooser: could not execute '%s': exit code %d",
-                     cmd, -ret / 256);
+    char **argv = launcher_expand(spec, mode, prefix, prefix_len, path,
+                                  req->result->path, call->side_path);
+    launcher_free_argv(words);
+    return argv;
+}
+
+// a copy of envp in arena, with entry in place of the variable it sets; NULL
+// if either of them is
+static char **envp_replace(struct xdptf_arena *arena, char **envp,
+                           char *entry)
+{
+    if (envp == NULL || entry == NULL) {
+        return NULL;
+    }
+    size_t name_len = strchr(entry, '=') - entry + 1;
+    size_t count = 0;
+    while (envp[count]) {
+        count++;
+    }
+
+    char **copy = xdptf_arena_alloc(arena, (count + 2) * sizeof(char *));
+    if (copy == NULL) {
+        return NULL;
+    }
+    size_t n = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (strncmp(envp[i], entry, name_len) != 0) {
+            copy[n++] = envp[i];
         }
-        remove(filename);
-        free(filename);
-        free(cmd);
+    }
+    copy[n++] = entry;
+    copy[n] = NULL;
+    return copy;
+}
+
+static int exec_filechooser(struct xdptf_request *req, bool writing,
+                            bool multiple, bool directory, char *path,
+                            xdptf_request_exit_handler on_exit)
+{
+    struct xdptf_state *state = req->state;
+    struct config_filechooser *config = req->config;
+    struct filechooser_call *call = req->data;
+    uint64_t start = xdptf_now_usec();
+    call->launcher = config->cmd_argc == 0;
+    if (call->launcher && !launcher_is_set(&config->launcher)) {
+        logprint(ERROR, "filechooser: cmd not specified");
         return -1;
     }
-    free(cmd);
 
-    FILE *fp = fopen(filename, "r");
-    if (fp == NULL) {
-        logprint(ERROR, "filechooser: failed to open '%s'", filename);
-        free(filename);
+    if (path == NULL) {
+        path = "";
+    }
+
+    // each request gets its own output, so overlapping choosers never
+    // clobber each other's selection
+    req->result =
+        xdptf_result_create(state, config->result_channel, req->handle);
+    if (req->result == NULL) {
         return -1;
     }
 
-    size_t nchars = 0, num_lines = 0;
-    int cr;
-    while ((cr = getc(fp)) != EOF) {
-        if (cr == '\n') {
-            if (nchars > 0)
-                num_lines++;
-            nchars = 0;
-        } else {
-            nchars++;
+    // a launcher without a terminal has no use for a warm one
+    if (!call->launcher || config->launcher.terminal) {
+        req->terminal = xdptf_pool_take(state);
+    }
+
+    // no shell in between, so paths are passed as they are, quotes and all
+    // the launcher's argv is built by launcher.c and freed here, the cmd
+    // one lives in the arena
+    char **argv;
+    const char *cmd_path;
+    char *found = NULL;
+    if (call->launcher) {
+        argv = launcher_argv(req, launcher_mode(writing, multiple, directory),
+                             path);
+        cmd_path = found = argv ? find_executable(config, argv[0]) : NULL;
+    } else {
+        argv = cmd_argv(req, writing, multiple, directory, path);
+        if (argv == NULL) {
+            return -ENOMEM;
         }
-
-        if (ferror(fp)) {
-            fclose(fp);
-            remove(filename);
-            free(filename);
-            return -1;
+        cmd_path = resolve_cmd(config);
+    }
+    call->cmd = cmd_path ? xdptf_arena_strdup(&req->arena, cmd_path) : NULL;
+    bool copied = cmd_path == NULL || call->cmd != NULL;
+    free(found);
+    if (argv == NULL || call->cmd == NULL) {
+        if (argv && copied) {
+            logprint(ERROR, "filechooser: '%s' not found", argv[0]);
+        }
+        if (call->launcher) {
+            launcher_free_argv(argv);
+        }
+        return copied ? -1 : -ENOMEM;
+    }
+
+    // point the wrapper's TERMCMD at a warm terminal, if there is one
+    char **envp = config->envp;
+    if (!call->launcher && req->terminal) {
+        char *attach = xdptf_arena_printf(
+            &req->arena, "TERMCMD=pool-shell.sh attach '%s' '%s'",
+            req->terminal->fifo, req->terminal->done_fifo);
+        envp = envp_replace(&req->arena, envp, attach);
+    }
+    // so file managers that can, hide what the app does not want
+    if (call->filter_patterns) {
+        char *filter = xdptf_arena_printf(
+            &req->arena, "TERMFILECHOOSER_FILTER=%s", call->filter_patterns);
+        envp = envp_replace(&req->arena, envp, filter);
+    }
+    if (envp == NULL) {
+        if (call->launcher) {
+            launcher_free_argv(argv);
         }
+        return -ENOMEM;
     }
 
-    // last line
-    if (nchars > 0)
-        num_lines++;
+    if (get_logger_level() >= TRACE) {
+        for (int i = 0; argv[i]; i++) {
+            logprint(TRACE, "filechooser: argv[%d] = '%s'", i, argv[i]);
+        }
+    }
+    // once the chooser runs, req belongs to on_exit and may already be
+    // gone, so nothing below looks at req or call
+    bool launcher = call->launcher;
+    int ret = xdptf_request_spawn(state, req, call->cmd, argv, envp, on_exit,
+                                  start);
+    if (launcher) {
+        launcher_free_argv(argv);
+    }
 
-    // rewind
-    if (fseek(fp, 0, SEEK_SET) != 0) {
-        fclose(fp);
-        remove(filename);
-        free(filename);
+    if (ret < 0) {
         return -1;
     }
 
-    if (num_lines == 0) {
-        fclose(fp);
-        remove(filename);
-        free(filename);
-        return -1;
+    return 0;
+}
+
+// opens the reply down to the uris array, for the selection to be streamed
+// into
+static int open_reply(sd_bus_message *msg, sd_bus_message **reply)
+{
+    int ret = sd_bus_message_new_method_return(msg, reply);
+    if (ret < 0) {
+        return ret;
     }
 
-    *num_selected_files = num_lines;
-    *selected_files = malloc((1 + num_lines) * sizeof(char *));
+    ret = sd_bus_message_append(*reply, "u", PORTAL_RESPONSE_SUCCESS);
+    if (ret < 0) {
+        return ret;
+    }
 
-    for (size_t i = 0; i < num_lines; i++) {
-        size_t n = 0;
-        char *line = NULL;
-        char *encoded = NULL;
-        ssize_t nread = getline(&line, &n, fp);
-        if (ferror(fp)) {
-            free(line);
-            for (size_t j = 0; j < i - 1; j++) {
-                free((*selected_files)[j]);
-            }
-            free(*selected_files);
-            fclose(fp);
-            remove(filename);
-            free(filename);
-            return -1;
-        }
-        // if all chars are encoded, size = orig_size * 3 + 1
-        encoded = malloc(1 + nread * 3);
-        size_t nenc = uri_encode(line, nread, encoded);
-        size_t str_size = 1 + nenc + strlen(PATH_PREFIX);
-        // check last char equal '\n'
-        if (nenc >= 3 && !strcmp(encoded + nenc - 3, "%0A")) {
-            str_size -= 3;
-        }
-        (*selected_files)[i] = malloc(str_size);
-        snprintf((*selected_files)[i], str_size, "%s%s", PATH_PREFIX, encoded);
-        free(line);
-        free(encoded);
+    ret = sd_bus_message_open_container(*reply, 'a', "{sv}");
+    if (ret < 0) {
+        return ret;
     }
-    (*selected_files)[num_lines] = NULL;
 
-    fclose(fp);
-    remove(filename);
-    free(filename);
-    return 0;
+    ret = sd_bus_message_open_container(*reply, 'e', "sv");
+    if (ret < 0) {
+        return ret;
+    }
+
+    ret = sd_bus_message_append_basic(*reply, 's', "uris");
+    if (ret < 0) {
+        return ret;
+    }
+
+    ret = sd_bus_message_open_container(*reply, 'v', "as");
+    if (ret < 0) {
+        return ret;
+    }
+
+    return sd_bus_message_open_container(*reply, 'a', "s");
 }
 
-static char *escape_path(char *path)
+static int append_uri(void *data, size_t index, const char *uri)
 {
-    // escape ' with '\'' in path
-    char *tmp = path;
-    size_t escaped_size = 0;
-    while (*tmp) {
-        escaped_size += (*tmp == '\'') ? 4 : 1;
-        tmp++;
-    }
-    escaped_size += 1;
-    char *escaped_path = malloc(escaped_size);
-    char *ptr = escaped_path;
-    tmp = path;
-    while (*tmp) {
-        if (*tmp == '\'') {
-            *ptr++ = '\'';
-            *ptr++ = '\\';
-            *ptr++ = '\'';
-            *ptr++ = '\'';
-        } else {
-            *ptr++ = *tmp;
-        }
-        tmp++;
-    }
-    *ptr = '\0';
-    return escaped_path;
+    sd_bus_message *reply = data;
+    logprint(DEBUG, "filechooser: %zu. %s", index, uri);
+    return sd_bus_message_append_basic(reply, 's', uri);
 }
 
-static char *get_last_dir_path(void)
+static int read_selection(struct xdptf_request *req, int status,
+                          sd_bus_message **reply, struct selection *selection)
 {
-    char *home = getenv("HOME");
-    char *state_home = getenv("XDG_STATE_HOME");
-    char *file_path = "xdg-desktop-portal-termfilechooser";
-    char *path = NULL;
+    struct filechooser_call *call = req->data;
+    struct config_filechooser *config = req->config;
 
-    if (state_home) {
-        size_t path_size =
-            1 + snprintf(NULL, 0, "%s/%s", state_home, file_path);
-        path = malloc(path_size);
-        snprintf(path, path_size, "%s/%s", state_home, file_path);
-    } else if (home) {
-        size_t path_size =
-            1 + snprintf(NULL, 0, "%s/.local/state/%s", home, file_path);
-        path = malloc(path_size);
-        snprintf(path, path_size, "%s/.local/state/%s", home, file_path);
+    if (req->cancelled) {
+        logprint(DEBUG, "filechooser: request was closed, dropping selection");
+        return -1;
     }
 
-    if (path) {
-        struct stat st = {0};
-        if (stat(path, &st) == -1) {
-            mkdir(path, 0755);
-        }
+    if (status == -1 || !WIFEXITED(status)) {
+        logprint(ERROR, "filechooser: could not execute '%s'", call->cmd);
+        return -1;
+    } else if (WEXITSTATUS(status) != 0) {
+        logprint(ERROR, "filechooser: could not execute '%s': exit code %d",
+                 call->cmd, WEXITSTATUS(status));
+        return -1;
     }
 
-    return path;
-}
+    char *data = NULL;
+    size_t size = 0;
+    if (xdptf_result_read(req->result, &data, &size) < 0) {
+        return -1;
+    }
 
-static char *read_last_dir(void)
-{
-    char *path = get_last_dir_path();
-    if (path == NULL) {
-        return NULL;
+    if (call->launcher) {
+        launcher_post_process(&config->launcher, &data, &size,
+                              call->side_path);
     }
 
-    char *filename = NULL;
+    if (size == 0) {
+        free(data);
+        return -1;
+    }
 
-    size_t filename_size = 1 + snprintf(NULL, 0, "%s/last_dir", path);
-    filename = malloc(filename_size);
-    snprintf(filename, filename_size, "%s/last_dir", path);
+    // the URIs go straight into the reply, which is the only copy of the
+    // selection that is kept
+    int ret = open_reply(req->msg, reply);
+    if (ret == 0) {
+        struct selection_budget budget = {
+            .max_count = config->max_selections,
+            .max_size = (size_t)config->max_selection_size * 1024,
+        };
+        const struct filter *filter =
+            call->type == SELECTION_FILES && filter_active(&call->filter)
+                ? &call->filter
+                : NULL;
+        ret = selection_parse(&req->arena, data, size, call->start_dir,
+                              &budget, call->type, filter, append_uri, *reply,
+                              selection);
+    }
+    free(data);
+    return ret;
+}
 
-    FILE *fp = fopen(filename, "r");
-    if (fp == NULL) {
-        logprint(WARN, "filechooser: failed to open '%s'", filename);
-        free(filename);
-        free(path);
-        return NULL;
+// closes what open_reply opened and sends the reply
+static int send_reply(sd_bus_message *reply)
+{
+    for (int i = 0; i < 4; i++) {
+        int ret = sd_bus_message_close_container(reply);
+        if (ret < 0) {
+            return ret;
+        }
     }
 
-    char *last_dir = NULL;
-    size_t n = 0;
-    ssize_t nread = getline(&last_dir, &n, fp);
+    return sd_bus_send(NULL, reply, NULL);
+}
 
-    if (nread <= 0) {
-        if (ferror(fp)) {
-            logprint(ERROR, "filechooser: failed to read '%s'", filename);
-        } else {
-            logprint(ERROR, "filechooser: no data read from '%s'", filename);
+// replies to the pending call and releases the request
+static void finish_request(struct xdptf_request *req, int ret)
+{
+    struct xdptf_stats *stats = &req->state->stats;
+
+    // a closed request has been answered already
+    if (ret == -E2BIG && !req->cancelled) {
+        // too much to pass back, which is not the caller's fault
+        uint64_t start = xdptf_now_usec();
+        int reply_ret = sd_bus_reply_method_return(req->msg, "ua{sv}",
+                                                   PORTAL_RESPONSE_ENDED, 0);
+        if (reply_ret < 0) {
+            logprint(ERROR, "dbus: failed to send reply: %s",
+                     strerror(-reply_ret));
         }
-        free(last_dir);
-        free(filename);
-        free(path);
-        fclose(fp);
-        return NULL;
+        xdptf_request_record(req, PHASE_REPLY, start);
+    } else if (ret < 0 && !req->cancelled) {
+        // same error reply sd-bus sends when a handler fails synchronously
+        uint64_t start = xdptf_now_usec();
+        int reply_ret = sd_bus_reply_method_errno(req->msg, -ret, NULL);
+        if (reply_ret < 0) {
+            logprint(ERROR, "dbus: failed to send error reply: %s",
+                     strerror(-reply_ret));
+        }
+        xdptf_request_record(req, PHASE_REPLY, start);
     }
 
-    if (last_dir[nread - 1] == '\n') {
-        last_dir[nread - 1] = '\0';
+    if (!req->cancelled) {
+        xdptf_request_record(req, PHASE_TOTAL, req->start_usec);
+        xdptf_stats_record_request(stats, req->app_id, ret < 0);
     }
 
-    fclose(fp);
-    free(filename);
-    free(path);
-
-    return last_dir;
+    xdptf_request_destroy(req);
 }
 
-static void write_last_dir(char *last_dir)
+// reads one (sa(us)) filter into call->filter and, if patterns is not NULL,
+// joins its globs there. Returns 0 at the end of the array it is in.
+static int read_filter(struct xdptf_request *req, sd_bus_message *msg,
+                       char **patterns)
 {
-    if (last_dir == NULL)
-        return;
+    struct filechooser_call *call = req->data;
+    int ret = sd_bus_message_enter_container(msg, 'r', "sa(us)");
+    if (ret <= 0) {
+        return ret;
+    }
 
-    char *path = get_last_dir_path();
-    if (path == NULL) {
-        return;
+    const char *name;
+    ret = sd_bus_message_read(msg, "s", &name);
+    if (ret < 0) {
+        return ret;
     }
+    logprint(DEBUG, "dbus: option filter: %s", name);
 
-    char *filename = NULL;
+    ret = sd_bus_message_enter_container(msg, 'a', "(us)");
+    if (ret < 0) {
+        return ret;
+    }
+    uint32_t type;
+    const char *pattern;
+    while ((ret = sd_bus_message_read(msg, "(us)", &type, &pattern)) > 0) {
+        if (type != 0) {
+            // MIME types would need the shared MIME database, so they let
+            // everything through
+            logprint(DEBUG, "filechooser: not checking MIME type %s", pattern);
+            pattern = "*";
+        } else if (patterns) {
+            *patterns = *patterns ? xdptf_arena_printf(&req->arena, "%s;%s",
+                                                       *patterns, pattern)
+                                  : xdptf_arena_strdup(&req->arena, pattern);
+            if (*patterns == NULL) {
+                return -ENOMEM;
+            }
+        }
+        int add_ret = filter_add(&call->filter, pattern);
+        if (add_ret < 0) {
+            return add_ret;
+        }
+    }
+    if (ret < 0) {
+        return ret;
+    }
 
-    size_t filename_size = 1 + snprintf(NULL, 0, "%s/last_dir", path);
-    filename = malloc(filename_size);
-    snprintf(filename, filename_size, "%s/last_dir", path);
+    ret = sd_bus_message_exit_container(msg);
+    if (ret < 0) {
+        return ret;
+    }
+    ret = sd_bus_message_exit_container(msg);
+    return ret < 0 ? ret : 1;
+}
 
-    FILE *fp = fopen(filename, "w");
-    if (fp == NULL) {
-        logprint(ERROR, "filechooser: failed to open '%s': %s", filename,
-                 strerror(errno));
-        free(filename);
-        free(path);
+// The filters are compiled into the request's arena, which only exists once
+// the other options have been read, so they get a second pass over them.
+// Selected files have to match one of the filters the user could have
+// picked in a dialog, so all of them are merged, and current_filter too, as
+// it may be passed without a list.
+static int read_filters(struct xdptf_request *req, sd_bus_message *msg)
+{
+    struct filechooser_call *call = req->data;
+    int ret = sd_bus_message_rewind(msg, 1);
+    if (ret < 0) {
+        return ret;
+    }
+    ret = sd_bus_message_skip(msg, "osss");
+    if (ret < 0) {
+        return ret;
+    }
+    ret = sd_bus_message_enter_container(msg, 'a', "{sv}");
+    if (ret < 0) {
+        return ret;
     }
 
-    fputs(last_dir, fp);
-    fputc('\n', fp);
+    char *first = NULL, *current = NULL;
+    while ((ret = sd_bus_message_enter_container(msg, 'e', "sv")) > 0) {
+        const char *key;
+        ret = sd_bus_message_read(msg, "s", &key);
+        if (ret < 0) {
+            return ret;
+        }
+
+        if (strcmp(key, "filters") == 0) {
+            ret = sd_bus_message_enter_container(msg, 'v', "a(sa(us))");
+            if (ret < 0) {
+                return ret;
+            }
+            ret = sd_bus_message_enter_container(msg, 'a', "(sa(us))");
+            if (ret < 0) {
+                return ret;
+            }
+            char **patterns = &first;
+            while ((ret = read_filter(req, msg, patterns)) > 0) {
+                patterns = NULL;
+            }
+            if (ret < 0) {
+                return ret;
+            }
+            ret = sd_bus_message_exit_container(msg);
+            if (ret < 0) {
+                return ret;
+            }
+        } else if (strcmp(key, "current_filter") == 0) {
+            ret = sd_bus_message_enter_container(msg, 'v', "(sa(us))");
+            if (ret < 0) {
+                return ret;
+            }
+            ret = read_filter(req, msg, &current);
+            if (ret < 0) {
+                return ret;
+            }
+        } else {
+            ret = sd_bus_message_skip(msg, "v");
+            if (ret < 0) {
+                return ret;
+            }
+            ret = sd_bus_message_exit_container(msg);
+            if (ret < 0) {
+                return ret;
+            }
+            continue;
+        }
 
-    fclose(fp);
-    free(filename);
-    free(path);
+        // the variant, then the dict entry
+        ret = sd_bus_message_exit_container(msg);
+        if (ret < 0) {
+            return ret;
+        }
+        ret = sd_bus_message_exit_container(msg);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+    if (ret < 0) {
+        return ret;
+    }
+
+    call->filter_patterns = current ? current : first;
+    return 0;
 }
 
-static void set_last_dir(char *encoded_selection)
+// the app_id last_dir is remembered for, or NULL for all apps
+static const char *last_dir_app(struct xdptf_request *req, enum Mode mode)
 {
-    char *encoded = encoded_selection + strlen(PATH_PREFIX);
+    return mode == MODE_LAST_PER_APP ? req->app_id : NULL;
+}
 
-    char *last_selected = malloc(1 + strlen(encoded));
-    uri_decode(encoded, strlen(encoded), last_selected);
+static void set_last_dir(struct xdptf_request *req, enum Mode mode,
+                         const struct selection *selection)
+{
+    struct xdptf_arena *arena = &req->arena;
+    char *encoded = selection->last + strlen(PATH_PREFIX);
 
-    struct stat path_stat = {0};
-    if (stat(last_selected, &path_stat) == -1) {
-        if (errno == ENOENT) {
-            logprint(ERROR, "filechooser: '%s' does not exist.", last_selected);
-        } else {
-            logprint(ERROR, "filechooser: failed to stat '%s': %s",
-                     last_selected, strerror(errno));
-        }
-        free(last_selected);
+    char *last_selected = xdptf_arena_alloc(arena, 1 + strlen(encoded));
+    if (last_selected == NULL) {
         return;
     }
+    uri_decode(encoded, strlen(encoded), last_selected);
 
-    if (S_ISDIR(path_stat.st_mode)) {
-        write_last_dir(last_selected);
-    } else if (S_ISREG(path_stat.st_mode)) {
-        char *parent = strdup(last_selected);
-        char *last_slash = strrchr(parent, '/');
-        if (last_slash) {
-            if (last_slash != parent) {
-                *last_slash = '\0';
+    // checked already if the selection was
+    mode_t type = selection->last_type;
+    if (type == 0) {
+        struct stat path_stat = {0};
+        if (stat(last_selected, &path_stat) == -1) {
+            if (errno == ENOENT) {
+                logprint(ERROR, "filechooser: '%s' does not exist.",
+                         last_selected);
             } else {
-                *++last_slash = '\0';
+                logprint(ERROR, "filechooser: failed to stat '%s': %s",
+                         last_selected, strerror(errno));
             }
+            return;
+        }
+        type = path_stat.st_mode;
+    }
+
+    if (S_ISDIR(type)) {
+        xdptf_last_dir_set(req->state, last_dir_app(req, mode), last_selected);
+    } else if (S_ISREG(type)) {
+        // last_selected is not needed anymore, so cut it down to its parent
+        char *last_slash = strrchr(last_selected, '/');
+        if (last_slash == NULL) {
+            return;
+        }
+        if (last_slash != last_selected) {
+            *last_slash = '\0';
         } else {
-            free(parent);
-            parent = NULL;
+            *++last_slash = '\0';
         }
-        write_last_dir(parent);
-        free(parent);
+        xdptf_last_dir_set(req->state, last_dir_app(req, mode), last_selected);
     }
-    free(last_selected);
 }
 
-static void set_current_folder(enum Mode *mode, char **default_dir,
+// picks the folder the chooser starts in; current_folder comes in as the
+// caller's suggestion, if any, and leaves as a copy in arena or NULL
+static void set_current_folder(struct xdptf_arena *arena, enum Mode *mode,
+                               char **default_dir, const char *last_dir,
                                char **current_folder)
 {
     switch (*mode) {
         case MODE_SUGGESTED_DIR:
             if (*current_folder != NULL)
-                *current_folder = strdup(*current_folder);
+                *current_folder = xdptf_arena_strdup(arena, *current_folder);
             break;
         case MODE_DEFAULT_DIR:
-            *current_folder = strdup(*default_dir);
+            *current_folder = *default_dir
+                                  ? xdptf_arena_strdup(arena, *default_dir)
+                                  : NULL;
             break;
         case MODE_LAST_DIR:
-            *current_folder = read_last_dir();
+        case MODE_LAST_PER_APP:
+            *current_folder =
+                last_dir ? xdptf_arena_strdup(arena, last_dir) : NULL;
             break;
     }
 
     if (*current_folder == NULL) {
         if (*default_dir != NULL) {
-            *current_folder = strdup(*default_dir);
+            *current_folder = xdptf_arena_strdup(arena, *default_dir);
             logprint(
                 DEBUG,
                 "filechooser: could not set current_folder; fallback to '%s'",
@@ -404,24 +668,132 @@ static void set_current_folder(enum Mode *mode, char **default_dir,
         }
     } else if (access(*current_folder, F_OK)) {
         if (*mode != MODE_DEFAULT_DIR && *default_dir != NULL) {
-            free(*current_folder);
-            *current_folder = strdup(*default_dir);
+            *current_folder = xdptf_arena_strdup(arena, *default_dir);
             logprint(
                 DEBUG,
                 "filechooser: could not set current_folder; fallback to '%s'",
                 *current_folder);
         } else {
-            free(*current_folder);
             *current_folder = NULL;
             logprint(WARN, "filechooser: could not set current_folder");
         }
     }
 }
 
+static void open_file_done(struct xdptf_request *req, int status)
+{
+    sd_bus_message *reply = NULL;
+    struct selection selection = {0};
+
+    uint64_t start = xdptf_now_usec();
+    int ret = read_selection(req, status, &reply, &selection);
+    if (!req->cancelled) {
+        xdptf_request_record(req, PHASE_PARSE, start);
+    }
+    if (ret) {
+        goto cleanup;
+    }
+
+    logprint(INFO, "filechooser: (OpenFile) Number of selected files: %zu",
+             selection.count);
+
+    enum Mode mode = req->config->modes->open_mode;
+    if (mode == MODE_LAST_DIR || mode == MODE_LAST_PER_APP) {
+        set_last_dir(req, mode, &selection);
+    }
+
+    start = xdptf_now_usec();
+    ret = send_reply(reply);
+    xdptf_request_record(req, PHASE_REPLY, start);
+
+cleanup:
+    sd_bus_message_unref(reply);
+    finish_request(req, ret);
+}
+
+static void save_file_done(struct xdptf_request *req, int status)
+{
+    struct filechooser_call *call = req->data;
+    char *path = call->save_path;
+    sd_bus_message *reply = NULL;
+    struct selection selection = {0};
+
+    uint64_t start = xdptf_now_usec();
+    int ret = read_selection(req, status, &reply, &selection);
+    if (!req->cancelled) {
+        xdptf_request_record(req, PHASE_PARSE, start);
+    }
+
+    logprint(INFO, "filechooser: (SaveFile) Number of selected files: %zu",
+             selection.count);
+
+    if (ret || selection.count != 1) {
+        // if file created
+        if (req->config->create_help_file == 1) {
+            remove(path);
+        }
+        if (selection.count > 1) {
+            logprint(ERROR, "filechooser: too many selected SaveFiles");
+        }
+        if (ret != -E2BIG) {
+            ret = -1;
+        }
+        goto cleanup;
+    }
+
+    // if file created
+    if (req->config->create_help_file == 1) {
+        char *decoded =
+            xdptf_arena_alloc(&req->arena, 1 + strlen(selection.last));
+        if (decoded == NULL) {
+            ret = -ENOMEM;
+            goto cleanup;
+        }
+        uri_decode(selection.last, strlen(selection.last), decoded);
+
+        struct stat statbuf;
+        if (stat(decoded + strlen(PATH_PREFIX), &statbuf) == 0) {
+            if (S_ISDIR(statbuf.st_mode)) {
+                logprint(ERROR,
+                         "filechooser: selected SaveFile is a directory");
+                ret = -1;
+                goto cleanup;
+            }
+        } else {
+            logprint(ERROR, "filechooser: failed to stat '%s': %s",
+                     decoded + strlen(PATH_PREFIX), strerror(errno));
+            ret = -1;
+            goto cleanup;
+        }
+
+        // the selection may name path differently, e.g. through a symlink
+        struct stat help_stat;
+        if (stat(path, &help_stat) == 0 &&
+            (help_stat.st_dev != statbuf.st_dev ||
+             help_stat.st_ino != statbuf.st_ino)) {
+            remove(path);
+        }
+    }
+
+    enum Mode mode = req->config->modes->save_mode;
+    if (mode == MODE_LAST_DIR || mode == MODE_LAST_PER_APP) {
+        set_last_dir(req, mode, &selection);
+    }
+
+    start = xdptf_now_usec();
+    ret = send_reply(reply);
+    xdptf_request_record(req, PHASE_REPLY, start);
+
+cleanup:
+    sd_bus_message_unref(reply);
+    finish_request(req, ret);
+}
+
 static int method_open_file(sd_bus_message *msg, void *data,
                             sd_bus_error *ret_error)
 {
     int ret = 0;
+    uint64_t start = xdptf_now_usec();
 
     char *handle, *app_id, *parent_window, *title;
     ret = sd_bus_message_read(msg, "osss", &handle, &app_id, &parent_window,
@@ -437,6 +809,7 @@ static int method_open_file(sd_bus_message *msg, void *data,
     char *key;
     int inner_ret = 0;
     int multiple = 0, directory = 0;
+    bool filters = false;
     char *current_folder = NULL;
     while ((ret = sd_bus_message_enter_container(msg, 'e', "sv")) > 0) {
         inner_ret = sd_bus_message_read(msg, "s", &key);
@@ -455,6 +828,11 @@ static int method_open_file(sd_bus_message *msg, void *data,
         } else if (strcmp(key, "directory") == 0) {
             sd_bus_message_read(msg, "v", "b", &directory);
             logprint(DEBUG, "dbus: option directory: %d", directory);
+        } else if (strcmp(key, "filters") == 0 ||
+                   strcmp(key, "current_filter") == 0) {
+            // read by read_filters once there is a request
+            filters = true;
+            sd_bus_message_skip(msg, "v");
         } else if (strcmp(key, "current_folder") == 0) {
             const void *p = NULL;
             size_t sz = 0;
@@ -491,111 +869,106 @@ static int method_open_file(sd_bus_message *msg, void *data,
         return ret;
     }
 
+    struct xdptf_state *state = data;
     struct xdptf_request *req =
-        xdptf_request_create(sd_bus_message_get_bus(msg), handle);
+        xdptf_request_create(state, msg, handle, app_id);
     if (req == NULL) {
+        xdptf_stats_record_request(&state->stats, app_id, true);
         return -ENOMEM;
     }
-
-    struct xdptf_state *state = data;
-    char **selected_files = NULL;
-    size_t num_selected_files = 0;
-
-    set_current_folder(&state->config->modes->open_mode,
-                       &state->config->default_dir, &current_folder);
-
-    char *escaped_path = escape_path(current_folder);
-    ret = exec_filechooser(data, false, multiple, directory, escaped_path,
-                           &selected_files, &num_selected_files);
-
-    free(current_folder);
-    if (ret) {
-        goto cleanup;
-    }
-
-    logprint(INFO, "filechooser: (OpenFile) Number of selected files: %d",
-             num_selected_files);
-    for (size_t i = 0; i < num_selected_files; i++) {
-        logprint(DEBUG, "filechooser: %d. %s", i, selected_files[i]);
-    }
-
-    if (state->config->modes->open_mode == MODE_LAST_DIR) {
-        set_last_dir(selected_files[num_selected_files - 1]);
-    }
-
-    sd_bus_message *reply = NULL;
-    ret = sd_bus_message_new_method_return(msg, &reply);
-    if (ret < 0) {
-        goto cleanup;
-    }
-
-    ret = sd_bus_message_append(reply, "u", PORTAL_RESPONSE_SUCCESS, 1);
-    if (ret < 0) {
-        goto cleanup;
-    }
-
-    ret = sd_bus_message_open_container(reply, 'a', "{sv}");
-    if (ret < 0) {
-        goto cleanup;
-    }
-
-    ret = sd_bus_message_open_container(reply, 'e', "sv");
-    if (ret < 0) {
-        goto cleanup;
-    }
-
-    ret = sd_bus_message_append_basic(reply, 's', "uris");
-    if (ret < 0) {
-        goto cleanup;
+    req->start_usec = start;
+    struct filechooser_call *call = create_filechooser_call(req);
+    if (call == NULL) {
+        xdptf_stats_record_request(&state->stats, app_id, true);
+        xdptf_request_destroy(req);
+        return -ENOMEM;
     }
+    call->type = directory ? SELECTION_DIRS : SELECTION_FILES;
+    req->data = call;
+    req->free_data = free_filechooser_call;
 
-    ret = sd_bus_message_open_container(reply, 'v', "as");
-    if (ret < 0) {
-        goto cleanup;
+    if (filters) {
+        ret = read_filters(req, msg);
+        if (ret < 0) {
+            xdptf_stats_record_request(&state->stats, app_id, true);
+            xdptf_request_destroy(req);
+            return ret;
+        }
     }
+    xdptf_request_record(req, PHASE_DECODE, start);
 
-    ret = sd_bus_message_append_strv(reply, selected_files);
-    if (ret < 0) {
-        goto cleanup;
-    }
+    uint64_t phase_start = xdptf_now_usec();
+    enum Mode *mode = &req->config->modes->open_mode;
+    set_current_folder(&req->arena, mode, &req->config->default_dir,
+                       xdptf_last_dir_get(state, last_dir_app(req, *mode)),
+                       &current_folder);
+    call->start_dir = current_folder;
+    xdptf_request_record(req, PHASE_CURRENT_FOLDER, phase_start);
 
-    ret = sd_bus_message_close_container(reply);
-    if (ret < 0) {
-        goto cleanup;
+    ret = exec_filechooser(req, false, multiple, directory, current_folder,
+                           open_file_done);
+    if (ret) {
+        xdptf_stats_record_request(&state->stats, app_id, true);
+        xdptf_request_destroy(req);
+        return ret;
     }
 
-    ret = sd_bus_message_close_container(reply);
-    if (ret < 0) {
-        goto cleanup;
-    }
+    // replied to from open_file_done once the chooser exits
+    return 1;
+}
 
-    ret = sd_bus_message_close_container(reply);
-    if (ret < 0) {
-        goto cleanup;
-    }
+// names tried for the help file: path itself, then path_1 and so on
+#define HELP_FILE_TRIES 100
 
-    ret = sd_bus_send(NULL, reply, NULL);
-    if (ret < 0) {
-        goto cleanup;
+// O_EXCL never clobbers an existing file, not even one created by a
+// concurrent save between choosing the name and opening it
+static char *create_help_file(struct xdptf_arena *arena, const char *path)
+{
+    size_t len = strlen(path);
+    // room for the largest suffix
+    size_t size = len + sizeof("_99");
+    char *help_path = xdptf_arena_alloc(arena, size);
+    if (help_path == NULL) {
+        return NULL;
     }
+    memcpy(help_path, path, len + 1);
 
-    sd_bus_message_unref(reply);
+    for (int i = 0; i < HELP_FILE_TRIES; i++) {
+        if (i > 0) {
+            snprintf(help_path + len, size - len, "_%d", i);
+        }
+        int fd = open(help_path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+        if (fd < 0) {
+            if (errno == EEXIST) {
+                continue;
+            }
+            logprint(ERROR, "filechooser: could not create '%s': %s",
+                     help_path, strerror(errno));
+            return NULL;
+        }
 
-cleanup:
-    for (size_t i = 0; i < num_selected_files; i++) {
-        free(selected_files[i]);
+        ssize_t written = write(fd, instructions, sizeof(instructions) - 1);
+        int err = written < 0 ? errno : EIO;
+        close(fd);
+        if (written != sizeof(instructions) - 1) {
+            logprint(ERROR, "filechooser: could not write '%s': %s", help_path,
+                     strerror(err));
+            unlink(help_path);
+            return NULL;
+        }
+        return help_path;
     }
-    free(selected_files);
-    free(escaped_path);
 
-    xdptf_request_destroy(req);
-    return ret;
+    logprint(ERROR, "filechooser: '%s' and %d names after it are taken", path,
+             HELP_FILE_TRIES - 1);
+    return NULL;
 }
 
 static int method_save_file(sd_bus_message *msg, void *data,
                             sd_bus_error *ret_error)
 {
     int ret = 0;
+    uint64_t start = xdptf_now_usec();
 
     char *handle, *app_id, *parent_window, *title;
     ret = sd_bus_message_read(msg, "osss", &handle, &app_id, &parent_window,
@@ -610,6 +983,7 @@ static int method_save_file(sd_bus_message *msg, void *data,
     }
     char *key;
     int inner_ret = 0;
+    bool filters = false;
     char *current_name = NULL;
     char *current_folder = NULL;
     while ((ret = sd_bus_message_enter_container(msg, 'e', "sv")) > 0) {
@@ -661,6 +1035,11 @@ static int method_save_file(sd_bus_message *msg, void *data,
             logprint(DEBUG,
                      "dbus: option replace current_name with current_file: %s",
                      current_name);
+        } else if (strcmp(key, "filters") == 0 ||
+                   strcmp(key, "current_filter") == 0) {
+            // read by read_filters once there is a request
+            filters = true;
+            sd_bus_message_skip(msg, "v");
         } else {
             logprint(WARN, "dbus: unknown option %s", key);
             sd_bus_message_skip(msg, "v");
@@ -674,13 +1053,38 @@ static int method_save_file(sd_bus_message *msg, void *data,
 
     struct xdptf_state *state = data;
     struct xdptf_request *req =
-        xdptf_request_create(sd_bus_message_get_bus(msg), handle);
+        xdptf_request_create(state, msg, handle, app_id);
     if (req == NULL) {
+        xdptf_stats_record_request(&state->stats, app_id, true);
         return -ENOMEM;
     }
+    req->start_usec = start;
+    struct filechooser_call *call = create_filechooser_call(req);
+    if (call == NULL) {
+        xdptf_stats_record_request(&state->stats, app_id, true);
+        xdptf_request_destroy(req);
+        return -ENOMEM;
+    }
+    req->data = call;
+    req->free_data = free_filechooser_call;
+
+    if (filters) {
+        ret = read_filters(req, msg);
+        if (ret < 0) {
+            xdptf_stats_record_request(&state->stats, app_id, true);
+            xdptf_request_destroy(req);
+            return ret;
+        }
+    }
+    xdptf_request_record(req, PHASE_DECODE, start);
 
-    set_current_folder(&state->config->modes->save_mode,
-                       &state->config->default_dir, &current_folder);
+    uint64_t phase_start = xdptf_now_usec();
+    enum Mode *mode = &req->config->modes->save_mode;
+    set_current_folder(&req->arena, mode, &req->config->default_dir,
+                       xdptf_last_dir_get(state, last_dir_app(req, *mode)),
+                       &current_folder);
+    call->start_dir = current_folder;
+    xdptf_request_record(req, PHASE_CURRENT_FOLDER, phase_start);
 
     if (current_name == NULL || *current_name == '\0') {
         current_name = "termfilechooser.tmp";
@@ -695,152 +1099,40 @@ static int method_save_file(sd_bus_message *msg, void *data,
         }
     }
 
-    size_t num_selected_files = 0;
-    size_t path_size = 2 + strlen(current_folder) + strlen(current_name);
-    char **selected_files = NULL;
-    char *path = malloc(path_size);
-    snprintf(path, path_size, "%s/%s", current_folder, current_name);
-
-    free(current_folder);
-
-    if (state->config->create_help_file == 1) {
-        while (access(path, F_OK) == 0) {
-            char *path_tmp = malloc(path_size);
-            memcpy(path_tmp, path, path_size);
-            path_size += 1;
-            path = realloc(path, path_size);
-            snprintf(path, path_size, "%s_", path_tmp);
-            free(path_tmp);
-        }
-
-        FILE *temp_file = fopen(path, "w");
-        if (temp_file == NULL) {
-            logprint(ERROR, "filechooser: could not write temporary file");
-            return -1;
-        }
-        fputs(instructions, temp_file);
-        fclose(temp_file);
+    char *path = xdptf_arena_printf(&req->arena, "%s/%s", current_folder,
+                                    current_name);
+    if (path == NULL) {
+        xdptf_stats_record_request(&state->stats, app_id, true);
+        xdptf_request_destroy(req);
+        return -ENOMEM;
     }
 
-    char *escaped_path = escape_path(path);
-
-    ret = exec_filechooser(data, true, false, false, escaped_path,
-                           &selected_files, &num_selected_files);
-
-    logprint(INFO, "filechooser: (SaveFile) Number of selected files: %d",
-             num_selected_files);
-
-    if (ret || num_selected_files != 1) {
-        // if file created
-        if (state->config->create_help_file == 1) {
-            remove(path);
-        }
-        if (num_selected_files > 1) {
-            logprint(ERROR, "filechooser: too many selected SaveFiles");
+    if (req->config->create_help_file == 1) {
+        phase_start = xdptf_now_usec();
+        path = create_help_file(&req->arena, path);
+        if (path == NULL) {
+            xdptf_stats_record_request(&state->stats, app_id, true);
+            xdptf_request_destroy(req);
+            return -1;
         }
-        goto cleanup;
+        xdptf_request_record(req, PHASE_HELP_FILE, phase_start);
     }
 
-    // if file created
-    if (state->config->create_help_file == 1) {
-        char *decoded = NULL;
-        logprint(DEBUG, "filechooser: %s", selected_files[0]);
-        decoded = malloc(1 + strlen(selected_files[0]));
-        uri_decode(selected_files[0], strlen(selected_files[0]), decoded);
+    call->save_path = path;
 
-        struct stat statbuf;
-        if (stat(decoded + strlen(PATH_PREFIX), &statbuf) == 0) {
-            if (S_ISDIR(statbuf.st_mode)) {
-                logprint(ERROR,
-                         "filechooser: selected SaveFile is a directory");
-                free(decoded);
-                goto cleanup;
-            }
-        } else {
-            logprint(ERROR, "filechooser: failed to stat '%s': %s",
-                     decoded + strlen(PATH_PREFIX), strerror(errno));
-            free(decoded);
-            goto cleanup;
-        }
+    ret = exec_filechooser(req, true, false, false, path, save_file_done);
 
-        if (strcmp(decoded + strlen(PATH_PREFIX), path) != 0) {
+    if (ret) {
+        if (req->config->create_help_file == 1) {
             remove(path);
         }
-        free(decoded);
-    }
-
-    if (state->config->modes->save_mode == MODE_LAST_DIR) {
-        set_last_dir(selected_files[num_selected_files - 1]);
-    }
-
-    sd_bus_message *reply = NULL;
-    ret = sd_bus_message_new_method_return(msg, &reply);
-    if (ret < 0) {
-        goto cleanup;
-    }
-
-    ret = sd_bus_message_append(reply, "u", PORTAL_RESPONSE_SUCCESS, 1);
-    if (ret < 0) {
-        goto cleanup;
-    }
-
-    ret = sd_bus_message_open_container(reply, 'a', "{sv}");
-    if (ret < 0) {
-        goto cleanup;
-    }
-
-    ret = sd_bus_message_open_container(reply, 'e', "sv");
-    if (ret < 0) {
-        goto cleanup;
-    }
-
-    ret = sd_bus_message_append_basic(reply, 's', "uris");
-    if (ret < 0) {
-        goto cleanup;
-    }
-
-    ret = sd_bus_message_open_container(reply, 'v', "as");
-    if (ret < 0) {
-        goto cleanup;
-    }
-
-    ret = sd_bus_message_append_strv(reply, selected_files);
-    if (ret < 0) {
-        goto cleanup;
-    }
-
-    ret = sd_bus_message_close_container(reply);
-    if (ret < 0) {
-        goto cleanup;
-    }
-
-    ret = sd_bus_message_close_container(reply);
-    if (ret < 0) {
-        goto cleanup;
-    }
-
-    ret = sd_bus_message_close_container(reply);
-    if (ret < 0) {
-        goto cleanup;
-    }
-
-    ret = sd_bus_send(NULL, reply, NULL);
-    if (ret < 0) {
-        goto cleanup;
-    }
-
-    sd_bus_message_unref(reply);
-
-cleanup:
-    for (size_t i = 0; i < num_selected_files; i++) {
-        free(selected_files[i]);
+        xdptf_stats_record_request(&state->stats, app_id, true);
+        xdptf_request_destroy(req);
+        return ret;
     }
-    free(selected_files);
-    free(escaped_path);
-    free(path);
 
-    xdptf_request_destroy(req);
-    return ret;
+    // replied to from save_file_done once the chooser exits
+    return 1;
 }
 
 static const sd_bus_vtable filechooser_vtable[] = {
@@ -855,6 +1147,7 @@ int xdptf_filechooser_init(struct xdptf_state *state)
 {
     sd_bus_slot *slot = NULL;
     logprint(DEBUG, "dbus: init %s", interface_name);
+    logprint(DEBUG, "filechooser: using the %s uri kernel", uri_kernel());
     int ret;
     ret = sd_bus_add_object_vtable(state->bus, &slot, object_path,
                                    interface_name, filechooser_vtable, state);
@@ -0,0 +1,148 @@
+#define _GNU_SOURCE
+#include "filter.h"
+#include <errno.h>
+#include <fnmatch.h>
+#include <string.h>
+
+// the children of a node are a list; suffixes are short and few enough
+// that this beats a table
+struct filter_node {
+    unsigned char c;
+    // a suffix ends here
+    bool end;
+    struct filter_node *child;
+    struct filter_node *sibling;
+};
+
+static struct filter_node *new_node(struct xdptf_arena *arena, unsigned char c)
+{
+    struct filter_node *node =
+        xdptf_arena_alloc(arena, sizeof(struct filter_node));
+    if (node) {
+        *node = (struct filter_node){.c = c};
+    }
+    return node;
+}
+
+static struct filter_node *find_child(const struct filter_node *node,
+                                      unsigned char c)
+{
+    struct filter_node *child = node->child;
+    while (child && child->c != c) {
+        child = child->sibling;
+    }
+    return child;
+}
+
+// for *suffix with nothing special in the suffix, the suffix, else NULL
+static const char *literal_suffix(const char *pattern)
+{
+    if (pattern[0] != '*' || pattern[1] == '\0' ||
+        strpbrk(pattern + 1, "*?[\\") != NULL) {
+        return NULL;
+    }
+    return pattern + 1;
+}
+
+static int add_suffix(struct filter *filter, const char *suffix)
+{
+    if (filter->suffixes == NULL) {
+        filter->suffixes = new_node(filter->arena, 0);
+        if (filter->suffixes == NULL) {
+            return -ENOMEM;
+        }
+    }
+
+    struct filter_node *node = filter->suffixes;
+    for (size_t i = strlen(suffix); i > 0; i--) {
+        unsigned char c = suffix[i - 1];
+        struct filter_node *child = find_child(node, c);
+        if (child == NULL) {
+            child = new_node(filter->arena, c);
+            if (child == NULL) {
+                return -ENOMEM;
+            }
+            child->sibling = node->child;
+            node->child = child;
+        }
+        node = child;
+    }
+    node->end = true;
+    return 0;
+}
+
+static int add_glob(struct filter *filter, const char *pattern)
+{
+    if (filter->num_globs == filter->globs_capacity) {
+        size_t capacity = filter->globs_capacity ? 2 * filter->globs_capacity
+                                                 : 4;
+        const char **globs =
+            xdptf_arena_alloc(filter->arena, capacity * sizeof(*globs));
+        if (globs == NULL) {
+            return -ENOMEM;
+        }
+        if (filter->num_globs) {
+            memcpy(globs, filter->globs, filter->num_globs * sizeof(*globs));
+        }
+        filter->globs = globs;
+        filter->globs_capacity = capacity;
+    }
+
+    filter->globs[filter->num_globs] =
+        xdptf_arena_strdup(filter->arena, pattern);
+    if (filter->globs[filter->num_globs] == NULL) {
+        return -ENOMEM;
+    }
+    filter->num_globs++;
+    return 0;
+}
+
+void filter_init(struct filter *filter, struct xdptf_arena *arena)
+{
+    *filter = (struct filter){.arena = arena};
+}
+
+int filter_add(struct filter *filter, const char *pattern)
+{
+    if (*pattern == '\0') {
+        return 0;
+    }
+    filter->num_patterns++;
+
+    if (strcmp(pattern, "*") == 0) {
+        filter->match_all = true;
+        return 0;
+    }
+    const char *suffix = literal_suffix(pattern);
+    return suffix ? add_suffix(filter, suffix) : add_glob(filter, pattern);
+}
+
+bool filter_active(const struct filter *filter)
+{
+    return filter->num_patterns > 0 && !filter->match_all;
+}
+
+bool filter_match(const struct filter *filter, const char *path, size_t len)
+{
+    if (!filter_active(filter)) {
+        return true;
+    }
+
+    const char *slash = memrchr(path, '/', len);
+    const char *name = slash ? slash + 1 : path;
+
+    const struct filter_node *node = filter->suffixes;
+    for (const char *ptr = path + len; node && ptr > name;) {
+        node = find_child(node, (unsigned char)*--ptr);
+        if (node && node->end) {
+            return true;
+        }
+    }
+
+    for (size_t i = 0; i < filter->num_globs; i++) {
+        if (fnmatch(filter->globs[i], name, 0) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,232 @@
+#include "last_dir.h"
+#include "logger.h"
+#include "xdptf.h"
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+// changes within this many seconds are written out together
+#define WRITE_DELAY_SEC 1
+
+static char *join(const char *a, const char *b)
+{
+    size_t size = strlen(a) + strlen(b) + 1;
+    char *joined = malloc(size);
+    snprintf(joined, size, "%s%s", a, b);
+    return joined;
+}
+
+static bool make_state_dir(struct xdptf_last_dir *last_dir)
+{
+    if (mkdir(last_dir->state_dir, 0755) == -1 && errno != EEXIST) {
+        logprint(ERROR, "last_dir: could not create '%s': %s",
+                 last_dir->state_dir, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+static void read_last_dir(struct xdptf_last_dir *last_dir)
+{
+    FILE *fp = fopen(last_dir->path, "r");
+    if (fp == NULL) {
+        logprint(DEBUG, "last_dir: could not open '%s': %s", last_dir->path,
+                 strerror(errno));
+        return;
+    }
+
+    char *line = NULL;
+    size_t n = 0;
+    ssize_t nread = getline(&line, &n, fp);
+    if (nread <= 0) {
+        if (ferror(fp)) {
+            logprint(ERROR, "last_dir: failed to read '%s'", last_dir->path);
+        } else {
+            logprint(ERROR, "last_dir: no data read from '%s'",
+                     last_dir->path);
+        }
+        free(line);
+        fclose(fp);
+        return;
+    }
+    fclose(fp);
+
+    if (line[nread - 1] == '\n') {
+        line[nread - 1] = '\0';
+    }
+    last_dir->dir = line;
+}
+
+// into a temporary file that is then renamed over the old one, so a crash
+// leaves either of them, never a truncated file
+static void write_last_dir(struct xdptf_last_dir *last_dir)
+{
+    last_dir->dirty = false;
+    if (last_dir->path == NULL || last_dir->dir == NULL) {
+        return;
+    }
+
+    if (!make_state_dir(last_dir)) {
+        return;
+    }
+
+    char *tmp = join(last_dir->path, ".XXXXXX");
+    int fd = mkstemp(tmp);
+    if (fd < 0) {
+        logprint(ERROR, "last_dir: could not create '%s': %s", tmp,
+                 strerror(errno));
+        free(tmp);
+        return;
+    }
+
+    int ret = dprintf(fd, "%s\n", last_dir->dir);
+    if (close(fd) == -1 || ret < 0 || rename(tmp, last_dir->path) == -1) {
+        logprint(ERROR, "last_dir: could not write '%s': %s", last_dir->path,
+                 strerror(errno));
+        unlink(tmp);
+    } else {
+        logprint(TRACE, "last_dir: wrote '%s'", last_dir->dir);
+    }
+    free(tmp);
+}
+
+static int handle_write(struct xdptf_state *state, int fd, short revents,
+                        void *data)
+{
+    uint64_t expirations;
+    if (read(fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN) {
+        return -errno;
+    }
+    if (state->last_dir.dirty) {
+        write_last_dir(&state->last_dir);
+    }
+    return 0;
+}
+
+void xdptf_last_dir_init(struct xdptf_state *state)
+{
+    struct xdptf_last_dir *last_dir = &state->last_dir;
+    *last_dir = (struct xdptf_last_dir){.timerfd = -1};
+
+    const char *state_home = getenv("XDG_STATE_HOME");
+    const char *home = getenv("HOME");
+    const char *name = "/xdg-desktop-portal-termfilechooser";
+    if (state_home) {
+        last_dir->state_dir = join(state_home, name);
+    } else if (home) {
+        char *local_state = join(home, "/.local/state");
+        last_dir->state_dir = join(local_state, name);
+        free(local_state);
+    } else {
+        return;
+    }
+    last_dir->path = join(last_dir->state_dir, "/last_dir");
+    read_last_dir(last_dir);
+
+    last_dir->apps_path = join(last_dir->state_dir, "/last_dirs");
+    int ret = mru_open(&last_dir->apps, last_dir->apps_path, false);
+    if (ret < 0 && ret != -ENOENT) {
+        logprint(ERROR, "last_dir: could not open '%s': %s",
+                 last_dir->apps_path, strerror(-ret));
+    }
+}
+
+const char *xdptf_last_dir_get(struct xdptf_state *state, const char *app_id)
+{
+    struct xdptf_last_dir *last_dir = &state->last_dir;
+    if (app_id && *app_id) {
+        const char *dir = mru_get(&last_dir->apps, app_id);
+        if (dir) {
+            return dir;
+        }
+    }
+    return last_dir->dir;
+}
+
+static void set_app_dir(struct xdptf_last_dir *last_dir, const char *app_id,
+                        const char *dir)
+{
+    if (last_dir->apps.file == NULL) {
+        if (last_dir->apps_path == NULL || !make_state_dir(last_dir)) {
+            return;
+        }
+        int ret = mru_open(&last_dir->apps, last_dir->apps_path, true);
+        if (ret < 0) {
+            logprint(ERROR, "last_dir: could not create '%s': %s",
+                     last_dir->apps_path, strerror(-ret));
+            return;
+        }
+    }
+
+    int ret = mru_set(&last_dir->apps, app_id, dir);
+    if (ret == -ENAMETOOLONG) {
+        logprint(DEBUG, "last_dir: '%s' is too long to remember for %s, "
+                        "using the last directory of all apps",
+                 dir, app_id);
+    } else if (ret < 0) {
+        logprint(WARN, "last_dir: not remembering '%s' for %s: %s", dir,
+                 app_id, strerror(-ret));
+    }
+}
+
+void xdptf_last_dir_set(struct xdptf_state *state, const char *app_id,
+                        const char *dir)
+{
+    struct xdptf_last_dir *last_dir = &state->last_dir;
+    // written back right away, one slot at a time
+    if (app_id && *app_id) {
+        set_app_dir(last_dir, app_id, dir);
+    }
+
+    if (last_dir->dir && strcmp(last_dir->dir, dir) == 0) {
+        return;
+    }
+    free(last_dir->dir);
+    last_dir->dir = strdup(dir);
+
+    // the timer is running already
+    if (last_dir->dirty) {
+        return;
+    }
+    last_dir->dirty = true;
+
+    if (last_dir->timerfd < 0) {
+        int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (fd >= 0 &&
+            xdptf_loop_add(state, fd, POLLIN, handle_write, NULL) < 0) {
+            close(fd);
+            fd = -1;
+        }
+        last_dir->timerfd = fd;
+    }
+
+    struct itimerspec spec = {.it_value = {.tv_sec = WRITE_DELAY_SEC}};
+    if (last_dir->timerfd < 0 ||
+        timerfd_settime(last_dir->timerfd, 0, &spec, NULL) < 0) {
+        logprint(WARN, "last_dir: could not delay writing: %s",
+                 strerror(errno));
+        write_last_dir(last_dir);
+    }
+}
+
+void xdptf_last_dir_finish(struct xdptf_state *state)
+{
+    struct xdptf_last_dir *last_dir = &state->last_dir;
+    if (last_dir->dirty) {
+        write_last_dir(last_dir);
+    }
+    if (last_dir->timerfd >= 0) {
+        xdptf_loop_remove(state, last_dir->timerfd);
+        close(last_dir->timerfd);
+    }
+    mru_close(&last_dir->apps);
+    free(last_dir->dir);
+    free(last_dir->state_dir);
+    free(last_dir->path);
+    free(last_dir->apps_path);
+}
@@ -0,0 +1,173 @@
+#include "mru.h"
+#include "logger.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define MRU_MAGIC "XDPTFMRU"
+#define MRU_VERSION 1
+
+_Static_assert(sizeof(struct mru_slot) == 1024, "mru slot size");
+_Static_assert((MRU_NUM_SLOTS & (MRU_NUM_SLOTS - 1)) == 0,
+               "MRU_NUM_SLOTS has to be a power of two");
+
+// FNV-1a, never 0 so that marks empty slots
+static uint64_t hash_app_id(const char *app_id, size_t len)
+{
+    uint64_t hash = 0xcbf29ce484222325;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)app_id[i];
+        hash *= 0x100000001b3;
+    }
+    return hash ? hash : 1;
+}
+
+static struct mru_slot *find_slot(struct mru_file *file, const char *app_id,
+                                  size_t len, uint64_t hash)
+{
+    for (size_t i = 0; i < MRU_PROBE; i++) {
+        struct mru_slot *slot =
+            &file->slots[(hash + i) & (MRU_NUM_SLOTS - 1)];
+        if (slot->hash == hash && memcmp(slot->app_id, app_id, len + 1) == 0) {
+            return slot;
+        }
+    }
+    return NULL;
+}
+
+// the part of the file from ptr on, size bytes of it
+static int write_back(struct mru *mru, const void *ptr, size_t size)
+{
+    off_t offset = (const char *)ptr - (const char *)mru->file;
+    ssize_t written = pwrite(mru->fd, ptr, size, offset);
+    if (written < 0) {
+        return -errno;
+    }
+    return (size_t)written == size ? 0 : -EIO;
+}
+
+static void reset_file(struct mru_file *file)
+{
+    memset(file, 0, sizeof(struct mru_file));
+    memcpy(file->magic, MRU_MAGIC, sizeof(file->magic));
+    file->version = MRU_VERSION;
+    file->num_slots = MRU_NUM_SLOTS;
+}
+
+int mru_open(struct mru *mru, const char *path, bool create)
+{
+    *mru = (struct mru){.fd = -1};
+    int fd = open(path, O_RDWR | O_CLOEXEC | (create ? O_CREAT : 0), 0600);
+    if (fd < 0) {
+        return -errno;
+    }
+
+    struct mru_file *file = malloc(sizeof(struct mru_file));
+    struct stat st;
+    if (file == NULL || fstat(fd, &st) == -1) {
+        int ret = file ? -errno : -ENOMEM;
+        free(file);
+        close(fd);
+        return ret;
+    }
+
+    ssize_t nread = 0;
+    if (st.st_size == sizeof(struct mru_file)) {
+        nread = pread(fd, file, sizeof(struct mru_file), 0);
+    }
+    mru->fd = fd;
+    mru->file = file;
+    if (nread != sizeof(struct mru_file) ||
+        memcmp(file->magic, MRU_MAGIC, sizeof(file->magic)) != 0 ||
+        file->version != MRU_VERSION || file->num_slots != MRU_NUM_SLOTS) {
+        if (st.st_size > 0) {
+            logprint(WARN, "mru: '%s' is not in the expected format, "
+                           "starting over",
+                     path);
+        }
+        reset_file(file);
+        int ret = ftruncate(fd, sizeof(struct mru_file)) == -1
+                      ? -errno
+                      : write_back(mru, file, sizeof(struct mru_file));
+        if (ret < 0) {
+            mru_close(mru);
+            return ret;
+        }
+    }
+    return 0;
+}
+
+const char *mru_get(struct mru *mru, const char *app_id)
+{
+    size_t len = strlen(app_id);
+    if (mru->file == NULL || len >= MRU_APP_ID_SIZE) {
+        return NULL;
+    }
+
+    struct mru_slot *slot =
+        find_slot(mru->file, app_id, len, hash_app_id(app_id, len));
+    // the file may have been written by something else
+    if (slot == NULL || memchr(slot->dir, '\0', MRU_DIR_SIZE) == NULL) {
+        return NULL;
+    }
+    return slot->dir;
+}
+
+int mru_set(struct mru *mru, const char *app_id, const char *dir)
+{
+    size_t len = strlen(app_id);
+    size_t dir_len = strlen(dir);
+    if (mru->file == NULL) {
+        return -EBADF;
+    }
+    if (len >= MRU_APP_ID_SIZE) {
+        return -ENAMETOOLONG;
+    }
+
+    struct mru_file *file = mru->file;
+    uint64_t hash = hash_app_id(app_id, len);
+    struct mru_slot *slot = find_slot(file, app_id, len, hash);
+    if (dir_len >= MRU_DIR_SIZE) {
+        // an older directory would be worse than none
+        if (slot) {
+            *slot = (struct mru_slot){0};
+            write_back(mru, slot, sizeof(*slot));
+        }
+        return -ENAMETOOLONG;
+    }
+    if (slot && strcmp(slot->dir, dir) == 0) {
+        slot->stamp = ++file->stamp;
+        int ret = write_back(mru, &file->stamp, sizeof(file->stamp));
+        return ret < 0 ? ret : write_back(mru, &slot->stamp,
+                                          sizeof(slot->stamp));
+    }
+
+    if (slot == NULL) {
+        // empty slots have a stamp of 0, so they go first
+        for (size_t i = 0; i < MRU_PROBE; i++) {
+            struct mru_slot *candidate =
+                &file->slots[(hash + i) & (MRU_NUM_SLOTS - 1)];
+            if (slot == NULL || candidate->stamp < slot->stamp) {
+                slot = candidate;
+            }
+        }
+    }
+
+    *slot = (struct mru_slot){.hash = hash, .stamp = ++file->stamp};
+    memcpy(slot->app_id, app_id, len + 1);
+    memcpy(slot->dir, dir, dir_len + 1);
+    int ret = write_back(mru, &file->stamp, sizeof(file->stamp));
+    return ret < 0 ? ret : write_back(mru, slot, sizeof(*slot));
+}
+
+void mru_close(struct mru *mru)
+{
+    if (mru->file) {
+        free(mru->file);
+        close(mru->fd);
+        *mru = (struct mru){.fd = -1};
+    }
+}
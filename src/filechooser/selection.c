@@ -0,0 +1,230 @@
+#include "selection.h"
+#include "canonical.h"
+#include "logger.h"
+#include "stat_batch.h"
+#include "uri.h"
+#include <errno.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/stat.h>
+
+// returns the next non-empty line at or after *pos and its length without
+// the newline, or NULL at the end of the data
+static const char *next_line(const char **pos, const char *end, size_t *len)
+{
+    while (*pos < end) {
+        const char *line = *pos;
+        const char *newline = memchr(line, '\n', end - line);
+        *pos = newline ? newline + 1 : end;
+        *len = (newline ? newline : end) - line;
+        if (*len > 0) {
+            return line;
+        }
+    }
+    return NULL;
+}
+
+// a string in a D-Bus array: its length, padded to 4 bytes, the string and
+// its NUL
+static size_t wire_size(size_t len)
+{
+    return 4 + ((len + 1 + 3) & ~(size_t)3);
+}
+
+static bool over_budget(const struct selection_budget *budget, size_t count,
+                        size_t size)
+{
+    return budget && ((budget->max_count && count > budget->max_count) ||
+                      (budget->max_size && size > budget->max_size));
+}
+
+// encodes paths into URIs for the handler, reusing one buffer
+struct uri_writer {
+    struct xdptf_arena *arena;
+    const struct selection_budget *budget;
+    selection_handler handler;
+    void *handler_data;
+    char *uri;
+    size_t uri_size;
+    size_t count;
+    size_t size;
+};
+
+static int write_uri(struct uri_writer *writer, const char *path,
+                     size_t path_len)
+{
+    const size_t prefix_len = strlen(PATH_PREFIX);
+    // if all chars are encoded, a path takes 3 times its size
+    if (prefix_len + path_len * 3 + 1 > writer->uri_size) {
+        writer->uri_size = 2 * (prefix_len + path_len * 3 + 1);
+        writer->uri = xdptf_arena_alloc(writer->arena, writer->uri_size);
+        if (writer->uri == NULL) {
+            return -ENOMEM;
+        }
+        memcpy(writer->uri, PATH_PREFIX, prefix_len);
+    }
+
+    bool valid = true;
+    size_t uri_len =
+        prefix_len +
+        uri_encode_utf8(path, path_len, writer->uri + prefix_len, &valid);
+    if (!valid) {
+        logprint(DEBUG, "selection: line %zu is not valid UTF-8",
+                 writer->count);
+    }
+
+    writer->size += wire_size(uri_len);
+    if (over_budget(writer->budget, writer->count + 1, writer->size)) {
+        logprint(ERROR, "selection: URIs take more than the configured "
+                        "budget after %zu paths", writer->count);
+        return -E2BIG;
+    }
+
+    int ret = writer->handler(writer->handler_data, writer->count, writer->uri);
+    if (ret < 0) {
+        return ret;
+    }
+    writer->count++;
+    return 0;
+}
+
+static bool check_type(const char *path, int found, enum selection_type type)
+{
+    const char *problem = NULL;
+    if (found < 0) {
+        problem = strerror(-found);
+    } else if (type == SELECTION_DIRS && !S_ISDIR(found)) {
+        problem = "not a directory";
+    } else if (type == SELECTION_FILES && S_ISDIR(found)) {
+        problem = "a directory";
+    }
+
+    if (problem) {
+        logprint(WARN, "selection: dropping '%s': %s", path, problem);
+        return false;
+    }
+    return true;
+}
+
+// The lines are counted first so the set of paths seen can be sized up
+// front; memchr makes that pass cheap next to the encoding. The budget is
+// only checked on what is left after duplicates are dropped.
+//
+// Without a type, each path is encoded right away. Otherwise the paths are
+// kept until all of them have been looked up in one batch.
+int selection_parse(struct xdptf_arena *arena, const char *data, size_t size,
+                    const char *base, const struct selection_budget *budget,
+                    enum selection_type type, const struct filter *filter,
+                    selection_handler handler, void *handler_data,
+                    struct selection *selection)
+{
+    const char *end = data + size;
+    const char *pos = data;
+    const char *line;
+    size_t len, num_lines = 0;
+    while ((line = next_line(&pos, end, &len))) {
+        num_lines++;
+    }
+
+    if (num_lines == 0) {
+        return -1;
+    }
+
+    struct canonical canonical;
+    int ret = canonical_init(&canonical, arena, base, num_lines);
+    if (ret < 0) {
+        return ret;
+    }
+
+    const char **paths = NULL;
+    size_t *path_lens = NULL;
+    size_t num_paths = 0;
+    if (type != SELECTION_ANY) {
+        paths = xdptf_arena_alloc(arena, num_lines * sizeof(*paths));
+        path_lens = xdptf_arena_alloc(arena, num_lines * sizeof(*path_lens));
+        if (paths == NULL || path_lens == NULL) {
+            return -ENOMEM;
+        }
+    }
+
+    struct uri_writer writer = {
+        .arena = arena,
+        .budget = budget,
+        .handler = handler,
+        .handler_data = handler_data,
+    };
+    pos = data;
+    while ((line = next_line(&pos, end, &len))) {
+        const char *path;
+        size_t path_len;
+        ret = canonical_add(&canonical, line, len, &path, &path_len);
+        if (ret == -EINVAL) {
+            logprint(WARN,
+                     "selection: dropping '%.*s', which is relative to no "
+                     "known folder",
+                     (int)len, line);
+            continue;
+        }
+        if (ret < 0) {
+            return ret;
+        }
+        if (ret == 0) {
+            logprint(DEBUG, "selection: dropping duplicate '%.*s'", (int)len,
+                     line);
+            continue;
+        }
+        // before the lookup, which costs more
+        if (filter && !filter_match(filter, path, path_len)) {
+            logprint(WARN, "selection: dropping '%s', which no filter matches",
+                     path);
+            continue;
+        }
+
+        if (paths == NULL) {
+            ret = write_uri(&writer, path, path_len);
+            if (ret < 0) {
+                return ret;
+            }
+            continue;
+        }
+
+        // path only lasts until the next canonical_add
+        char *copy = xdptf_arena_alloc(arena, path_len + 1);
+        if (copy == NULL) {
+            return -ENOMEM;
+        }
+        memcpy(copy, path, path_len);
+        copy[path_len] = '\0';
+        paths[num_paths] = copy;
+        path_lens[num_paths++] = path_len;
+    }
+
+    mode_t last_type = 0;
+    if (paths) {
+        int *types = xdptf_arena_alloc(arena, num_paths * sizeof(*types));
+        if (types == NULL) {
+            return -ENOMEM;
+        }
+        stat_batch(paths, num_paths, types);
+
+        for (size_t i = 0; i < num_paths; i++) {
+            if (!check_type(paths[i], types[i], type)) {
+                continue;
+            }
+            ret = write_uri(&writer, paths[i], path_lens[i]);
+            if (ret < 0) {
+                return ret;
+            }
+            last_type = types[i];
+        }
+    }
+    if (writer.count == 0) {
+        return -1;
+    }
+
+    selection->last = writer.uri;
+    selection->last_type = last_type;
+    selection->count = writer.count;
+    selection->size = writer.size;
+    return 0;
+}
@@ -33,57 +33,544 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
 #include "uri.h"
+#include <errno.h>
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define URI_X86 1
+#include <immintrin.h>
+#endif
 
 /*
  uri.c - functions for URI percent encoding / decoding
+
+ The table in uri.h is the definition of what gets escaped; the vector
+ kernels only find runs of bytes it leaves alone (A-Z a-z 0-9 - . / _ ~)
+ and copy them in bulk, everything else goes through the table. Encoding
+ also checks the input is UTF-8 on the way, which does not change what is
+ written.
 */
 
-size_t uri_encode (const char *src, const size_t len, char *dst)
+typedef size_t (*encode_fn)(const unsigned char *src, size_t len, char *dst,
+                            bool *valid);
+typedef size_t (*decode_fn)(const unsigned char *src, size_t len, char *dst);
+
+/* length of the well-formed UTF-8 sequence starting with the non-ASCII byte
+   s[0], 0 if there is none */
+static inline size_t utf8_length(const unsigned char *s, size_t avail)
 {
+  const unsigned char c = s[0];
+  unsigned char lo = 0x80, hi = 0xBF;
+  size_t n;
+
+  if (c < 0xC2) return 0;
+  else if (c < 0xE0) n = 2;
+  else if (c < 0xF0) {
+    n = 3;
+    if (c == 0xE0) lo = 0xA0;      /* overlong */
+    else if (c == 0xED) hi = 0x9F; /* surrogates */
+  }
+  else if (c < 0xF5) {
+    n = 4;
+    if (c == 0xF0) lo = 0x90;      /* overlong */
+    else if (c == 0xF4) hi = 0x8F; /* above U+10FFFF */
+  }
+  else return 0;
+
+  if (n > avail || s[1] < lo || s[1] > hi) return 0;
+  if (n > 2 && (s[2] & 0xC0) != 0x80) return 0;
+  if (n > 3 && (s[3] & 0xC0) != 0x80) return 0;
+  return n;
+}
+
+static inline bool is_plain(const unsigned char octet)
+{
+  return uri_encode_tbl[sizeof(int32_t) * octet] == 0;
+}
+
+/* the 4 byte store includes the table's NUL, which the next byte or the
+   terminator overwrites; dst always has room for it */
+static inline void encode_octet(const unsigned char octet, char *dst)
+{
+  memcpy(dst, &uri_encode_tbl[sizeof(int32_t) * octet], sizeof(int32_t));
+}
+
+/* escapes src[*i]; when validating, a non-ASCII byte is escaped together
+   with the rest of its UTF-8 sequence */
+static inline __attribute__((always_inline))
+void encode_escaped(const unsigned char *src, size_t len, char *dst,
+                    size_t *i, size_t *j, bool *valid, const bool validate)
+{
+  size_t n = 1;
+  if (validate && src[*i] >= 0x80) {
+    n = utf8_length(src + *i, len - *i);
+    if (n == 0) {
+      *valid = false;
+      n = 1;
+    }
+  }
+  for (size_t k = 0; k < n; k++) {
+    encode_octet(src[(*i)++], dst + *j);
+    *j += 3;
+  }
+}
+
+/*
+ The kernels keep the validity flag in a local, which the compiler can hold
+ in a register; through the pointer every store to dst could alias it.
+*/
+
+static inline __attribute__((always_inline))
+void encode_bytes(const unsigned char *src, size_t len, char *dst,
+                  size_t *i, size_t *j, bool *valid, const bool validate)
+{
+  while (*i < len)
+  {
+    if (is_plain(src[*i])) dst[(*j)++] = src[(*i)++];
+    else encode_escaped(src, len, dst, i, j, valid, validate);
+  }
+}
+
+static size_t encode_scalar(const unsigned char *src, size_t len, char *dst,
+                            bool *valid)
+{
+  bool ok = *valid;
   size_t i = 0, j = 0;
-  while (i < len)
+  encode_bytes(src, len, dst, &i, &j, &ok, true);
+  *valid = ok;
+  dst[j] = '\0';
+  return j;
+}
+
+/* one step of uri_decode at src[i]; returns the source bytes consumed */
+static inline size_t decode_octet(const unsigned char *src, size_t i,
+                                  size_t len, char *dst)
+{
+  if(src[i] == '%' && i + 2 < len)
   {
-    const char octet = src[i++];
-    const int32_t code = ((int32_t*)uri_encode_tbl)[ (unsigned char)octet ];
-    if (code) {
-        *((int32_t*)&dst[j]) = code;
-        j += 3;
+    const unsigned char v1 = hexval[ src[i+1] ];
+    const unsigned char v2 = hexval[ src[i+2] ];
+
+    /* skip invalid hex sequences */
+    if ((v1 | v2) != 0xFF)
+    {
+      *dst = (v1 << 4) | v2;
+      return 3;
     }
-    else dst[j++] = octet;
   }
+  *dst = src[i];
+  return 1;
+}
+
+static inline __attribute__((always_inline))
+void decode_bytes(const unsigned char *src, size_t end, size_t len, char *dst,
+                  size_t *i, size_t *j)
+{
+  while (*i < end)
+  {
+    *i += decode_octet(src, *i, len, dst + (*j)++);
+  }
+}
+
+static size_t decode_scalar(const unsigned char *src, size_t len, char *dst)
+{
+  size_t i = 0, j = 0;
+  decode_bytes(src, len, len, dst, &i, &j);
   dst[j] = '\0';
   return j;
 }
 
-size_t uri_decode (const char *src, const size_t len, char *dst)
+#ifdef URI_X86
+
+/*
+ The vector kernels look at one block of 16 or 32 bytes at a time. A block
+ of nothing but plain bytes is stored as is; otherwise the block is still
+ stored, which covers the run of plain bytes up to the first special one,
+ and the rest of the block goes byte by byte. The AVX2 kernels hand what is
+ left to the SSE2 loops, inlined so they are VEX encoded as well.
+
+ The stores stay inside dst: encoding writes at most 3 bytes per source
+ byte and decoding never gets ahead of the source, and a block is only
+ loaded while a whole one is left in src.
+*/
+
+/* bytes the table leaves alone; signed compares keep 0x80-0xFF out */
+static inline __attribute__((always_inline, target("sse2")))
+uint32_t plain_mask_sse2(__m128i v)
+{
+  const __m128i folded = _mm_or_si128(v, _mm_set1_epi8(0x20));
+  const __m128i alpha = _mm_and_si128(
+      _mm_cmpgt_epi8(folded, _mm_set1_epi8('a' - 1)),
+      _mm_cmpgt_epi8(_mm_set1_epi8('z' + 1), folded));
+  /* '-' '.' '/' and the digits are contiguous */
+  const __m128i digit = _mm_and_si128(
+      _mm_cmpgt_epi8(v, _mm_set1_epi8('-' - 1)),
+      _mm_cmpgt_epi8(_mm_set1_epi8('9' + 1), v));
+  const __m128i other = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('_')),
+                                     _mm_cmpeq_epi8(v, _mm_set1_epi8('~')));
+  return _mm_movemask_epi8(_mm_or_si128(_mm_or_si128(alpha, digit), other));
+}
+
+/* finishes a block that is not all plain; bit k of plain is set for a plain
+   src[start + k]. A validated sequence may run past the end of the block,
+   the next block then starts after it. */
+static inline __attribute__((always_inline))
+void encode_block(const unsigned char *src, size_t len, size_t start,
+                  size_t width, uint32_t plain, char *dst, size_t *i,
+                  size_t *j, bool *valid, const bool validate)
 {
+  const size_t run = __builtin_ctz(~plain);
+  *i += run;
+  *j += run;
+  while (*i < start + width) {
+    if (plain >> (*i - start) & 1) dst[(*j)++] = src[(*i)++];
+    else encode_escaped(src, len, dst, i, j, valid, validate);
+  }
+}
+
+static inline __attribute__((always_inline, target("sse2")))
+void encode_blocks_sse2(const unsigned char *src, size_t len, char *dst,
+                        size_t *i, size_t *j, bool *valid,
+                        const bool validate)
+{
+  while (*i + 16 <= len)
+  {
+    const __m128i v = _mm_loadu_si128((const __m128i *)(src + *i));
+    const uint32_t plain = plain_mask_sse2(v);
+    _mm_storeu_si128((__m128i *)(dst + *j), v);
+    if (plain != 0xFFFF) {
+      encode_block(src, len, *i, 16, plain, dst, i, j, valid, validate);
+      continue;
+    }
+    *i += 16;
+    *j += 16;
+  }
+}
+
+static inline __attribute__((always_inline, target("sse2")))
+void decode_blocks_sse2(const unsigned char *src, size_t len, char *dst,
+                        size_t *i, size_t *j)
+{
+  const __m128i percent = _mm_set1_epi8('%');
+  while (*i + 16 <= len)
+  {
+    const __m128i v = _mm_loadu_si128((const __m128i *)(src + *i));
+    const uint32_t mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, percent));
+    _mm_storeu_si128((__m128i *)(dst + *j), v);
+    if (mask) {
+      const size_t end = *i + 16, run = __builtin_ctz(mask);
+      *i += run;
+      *j += run;
+      decode_bytes(src, end, len, dst, i, j);
+      continue;
+    }
+    *i += 16;
+    *j += 16;
+  }
+}
+
+__attribute__((target("sse2")))
+static size_t encode_sse2(const unsigned char *src, size_t len, char *dst,
+                          bool *valid)
+{
+  bool ok = *valid;
   size_t i = 0, j = 0;
-  while(i < len)
+  encode_blocks_sse2(src, len, dst, &i, &j, &ok, true);
+  encode_bytes(src, len, dst, &i, &j, &ok, true);
+  *valid = ok;
+  dst[j] = '\0';
+  return j;
+}
+
+__attribute__((target("sse2")))
+static size_t decode_sse2(const unsigned char *src, size_t len, char *dst)
+{
+  size_t i = 0, j = 0;
+  decode_blocks_sse2(src, len, dst, &i, &j);
+  decode_bytes(src, len, len, dst, &i, &j);
+  dst[j] = '\0';
+  return j;
+}
+
+static inline __attribute__((always_inline, target("avx2")))
+uint32_t plain_mask_avx2(__m256i v)
+{
+  const __m256i folded = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+  const __m256i alpha = _mm256_and_si256(
+      _mm256_cmpgt_epi8(folded, _mm256_set1_epi8('a' - 1)),
+      _mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), folded));
+  const __m256i digit = _mm256_and_si256(
+      _mm256_cmpgt_epi8(v, _mm256_set1_epi8('-' - 1)),
+      _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), v));
+  const __m256i other =
+      _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('_')),
+                      _mm256_cmpeq_epi8(v, _mm256_set1_epi8('~')));
+  return _mm256_movemask_epi8(
+      _mm256_or_si256(_mm256_or_si256(alpha, digit), other));
+}
+
+/*
+ UTF-8 validation of whole blocks with nibble lookups, after Keiser and
+ Lemire, "Validating UTF-8 In Less Than One Instruction Per Byte". Every
+ byte is classified together with the one before it, the table entries
+ being the errors a pair can take part in; the byte two or three back
+ decides whether a continuation is required.
+*/
+#define TOO_SHORT      (1 << 0)
+#define TOO_LONG       (1 << 1)
+#define OVERLONG_3     (1 << 2)
+#define TOO_LARGE      (1 << 3)
+#define SURROGATE      (1 << 4)
+#define OVERLONG_2     (1 << 5)
+#define TOO_LARGE_1000 (1 << 6)
+#define OVERLONG_4     (1 << 6)
+#define TWO_CONTS      (1 << 7)
+#define CARRY          (TOO_SHORT | TOO_LONG | TWO_CONTS)
+
+#define LOOKUP16(...) _mm256_setr_epi8(__VA_ARGS__, __VA_ARGS__)
+
+struct utf8_check {
+  __m256i error;
+  __m256i prev;
+  /* lead bytes at the end of the previous block that still need more */
+  __m256i incomplete;
+};
+
+static inline __attribute__((always_inline, target("avx2")))
+void utf8_check_block(struct utf8_check *check, const __m256i input)
+{
+  if (_mm256_movemask_epi8(input) == 0) {
+    check->error = _mm256_or_si256(check->error, check->incomplete);
+    check->incomplete = _mm256_setzero_si256();
+    check->prev = input;
+    return;
+  }
+
+  const __m256i nibble = _mm256_set1_epi8(0x0F);
+  const __m256i carried = _mm256_permute2x128_si256(check->prev, input, 0x21);
+  const __m256i prev1 = _mm256_alignr_epi8(input, carried, 15);
+  const __m256i prev2 = _mm256_alignr_epi8(input, carried, 14);
+  const __m256i prev3 = _mm256_alignr_epi8(input, carried, 13);
+
+  const __m256i byte_1_high = _mm256_shuffle_epi8(
+      LOOKUP16(TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+               TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+               TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+               TOO_SHORT | OVERLONG_2,
+               TOO_SHORT,
+               TOO_SHORT | OVERLONG_3 | SURROGATE,
+               TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4),
+      _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble));
+  const __m256i byte_1_low = _mm256_shuffle_epi8(
+      LOOKUP16(CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4,
+               CARRY | OVERLONG_2,
+               CARRY,
+               CARRY,
+               CARRY | TOO_LARGE,
+               CARRY | TOO_LARGE | TOO_LARGE_1000,
+               CARRY | TOO_LARGE | TOO_LARGE_1000,
+               CARRY | TOO_LARGE | TOO_LARGE_1000,
+               CARRY | TOO_LARGE | TOO_LARGE_1000,
+               CARRY | TOO_LARGE | TOO_LARGE_1000,
+               CARRY | TOO_LARGE | TOO_LARGE_1000,
+               CARRY | TOO_LARGE | TOO_LARGE_1000,
+               CARRY | TOO_LARGE | TOO_LARGE_1000,
+               CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,
+               CARRY | TOO_LARGE | TOO_LARGE_1000,
+               CARRY | TOO_LARGE | TOO_LARGE_1000),
+      _mm256_and_si256(prev1, nibble));
+  const __m256i byte_2_high = _mm256_shuffle_epi8(
+      LOOKUP16(TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+               TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+               TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 |
+                   TOO_LARGE_1000 | OVERLONG_4,
+               TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,
+               TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+               TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+               TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT),
+      _mm256_and_si256(_mm256_srli_epi16(input, 4), nibble));
+  const __m256i special = _mm256_and_si256(
+      _mm256_and_si256(byte_1_high, byte_1_low), byte_2_high);
+
+  /* only 111_____ two back and 1111____ three back reach 0x80 */
+  const __m256i third = _mm256_subs_epu8(prev2, _mm256_set1_epi8(0xE0 - 0x80));
+  const __m256i fourth = _mm256_subs_epu8(prev3, _mm256_set1_epi8(0xF0 - 0x80));
+  const __m256i must_continue = _mm256_and_si256(
+      _mm256_or_si256(third, fourth), _mm256_set1_epi8((char)0x80));
+
+  check->error = _mm256_or_si256(check->error,
+                                 _mm256_xor_si256(must_continue, special));
+  check->incomplete = _mm256_subs_epu8(
+      input, _mm256_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                              -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                              -1, -1, -1, -1, -1, -1, -1, 0xF0 - 1,
+                              0xE0 - 1, 0xC0 - 1));
+  check->prev = input;
+}
+
+/* the tail is checked from a zero padded copy; the zeros end any sequence
+   left open, which then shows up as too short */
+static inline __attribute__((always_inline, target("avx2")))
+bool utf8_check_finish(struct utf8_check *check, const unsigned char *src,
+                       size_t len)
+{
+  if (len > 0) {
+    unsigned char tail[32] = {0};
+    memcpy(tail, src, len);
+    utf8_check_block(check, _mm256_loadu_si256((const __m256i *)tail));
+  }
+  check->error = _mm256_or_si256(check->error, check->incomplete);
+  return _mm256_testz_si256(check->error, check->error);
+}
+
+#undef LOOKUP16
+#undef TOO_SHORT
+#undef TOO_LONG
+#undef OVERLONG_3
+#undef TOO_LARGE
+#undef SURROGATE
+#undef OVERLONG_2
+#undef TOO_LARGE_1000
+#undef OVERLONG_4
+#undef TWO_CONTS
+#undef CARRY
+
+/* validation is done on the vectors here, the byte loops only escape */
+__attribute__((target("avx2")))
+static size_t encode_avx2(const unsigned char *src, size_t len, char *dst,
+                          bool *valid)
+{
+  struct utf8_check check = {
+    _mm256_setzero_si256(), _mm256_setzero_si256(), _mm256_setzero_si256()
+  };
+  bool unused = true;
+  size_t i = 0, j = 0;
+  while (i + 32 <= len)
   {
-    int copy_char = 1;
-    if(src[i] == '%' && i + 2 < len)
-    {
-      const unsigned char v1 = hexval[ (unsigned char)src[i+1] ];
-      const unsigned char v2 = hexval[ (unsigned char)src[i+2] ];
-
-      /* skip invalid hex sequences */
-      if ((v1 | v2) != 0xFF)
-      {
-        dst[j] = (v1 << 4) | v2;
-        j++;
-        i += 3;
-        copy_char = 0;
-      }
+    const __m256i v = _mm256_loadu_si256((const __m256i *)(src + i));
+    const uint32_t plain = plain_mask_avx2(v);
+    _mm256_storeu_si256((__m256i *)(dst + j), v);
+    utf8_check_block(&check, v);
+    if (plain != 0xFFFFFFFF) {
+      encode_block(src, len, i, 32, plain, dst, &i, &j, &unused, false);
+      continue;
     }
-    if (copy_char)
-    {
-      dst[j] = src[i];
-      i++;
-      j++;
+    i += 32;
+    j += 32;
+  }
+  if (!utf8_check_finish(&check, src + i, len - i)) *valid = false;
+  encode_blocks_sse2(src, len, dst, &i, &j, &unused, false);
+  encode_bytes(src, len, dst, &i, &j, &unused, false);
+  dst[j] = '\0';
+  return j;
+}
+
+__attribute__((target("avx2")))
+static size_t decode_avx2(const unsigned char *src, size_t len, char *dst)
+{
+  const __m256i percent = _mm256_set1_epi8('%');
+  size_t i = 0, j = 0;
+  while (i + 32 <= len)
+  {
+    const __m256i v = _mm256_loadu_si256((const __m256i *)(src + i));
+    const uint32_t mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, percent));
+    _mm256_storeu_si256((__m256i *)(dst + j), v);
+    if (mask) {
+      const size_t end = i + 32, run = __builtin_ctz(mask);
+      i += run;
+      j += run;
+      decode_bytes(src, end, len, dst, &i, &j);
+      continue;
     }
+    i += 32;
+    j += 32;
   }
+  decode_blocks_sse2(src, len, dst, &i, &j);
+  decode_bytes(src, len, len, dst, &i, &j);
   dst[j] = '\0';
   return j;
 }
+
+#endif
+
+static const struct {
+  const char *name;
+  encode_fn encode;
+  decode_fn decode;
+} kernels[] = {
+#ifdef URI_X86
+  {"avx2", encode_avx2, decode_avx2},
+  {"sse2", encode_sse2, decode_sse2},
+#endif
+  {"scalar", encode_scalar, decode_scalar},
+};
+
+#define NUM_KERNELS (sizeof(kernels) / sizeof(kernels[0]))
+
+/* index into kernels, picked on first use */
+static int kernel = -1;
+
+static bool kernel_supported(size_t index)
+{
+#ifdef URI_X86
+  __builtin_cpu_init();
+  if (strcmp(kernels[index].name, "avx2") == 0)
+    return __builtin_cpu_supports("avx2");
+  if (strcmp(kernels[index].name, "sse2") == 0)
+    return __builtin_cpu_supports("sse2");
+#endif
+  return true;
+}
+
+static void pick_kernel(void)
+{
+  if (kernel >= 0) return;
+  for (size_t i = 0; i < NUM_KERNELS; i++) {
+    if (kernel_supported(i)) {
+      kernel = i;
+      return;
+    }
+  }
+}
+
+const char *uri_kernel(void)
+{
+  pick_kernel();
+  return kernels[kernel].name;
+}
+
+int uri_set_kernel(const char *name)
+{
+  for (size_t i = 0; i < NUM_KERNELS; i++) {
+    if (strcmp(kernels[i].name, name) == 0) {
+      if (!kernel_supported(i)) return -ENOTSUP;
+      kernel = i;
+      return 0;
+    }
+  }
+  return -ENOENT;
+}
+
+size_t uri_encode_utf8(const char *src, const size_t len, char *dst,
+                       bool *valid)
+{
+  bool ok = true;
+  pick_kernel();
+  size_t j = kernels[kernel].encode((const unsigned char *)src, len, dst, &ok);
+  if (valid) *valid = ok;
+  return j;
+}
+
+size_t uri_encode (const char *src, const size_t len, char *dst)
+{
+  return uri_encode_utf8(src, len, dst, NULL);
+}
+
+size_t uri_decode (const char *src, const size_t len, char *dst)
+{
+  pick_kernel();
+  return kernels[kernel].decode((const unsigned char *)src, len, dst);
+}
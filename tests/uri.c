@@ -0,0 +1,206 @@
+// Checks every uri kernel this CPU can run against the plain table loop
+// uri.c started out as, on random input: uri_encode_utf8 with its validity
+// flag, uri_encode and uri_decode all have to match byte for byte.
+#include "uri.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ROUNDS 20000
+#define MAX_LEN 300
+
+static const char *const kernels[] = {"avx2", "sse2", "scalar"};
+
+// xorshift64, seeded the same every run so a failure can be reproduced
+static uint64_t rng = 0x9e3779b97f4a7c15;
+
+static uint64_t random_u64(void)
+{
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    return rng;
+}
+
+static size_t reference_encode(const unsigned char *src, size_t len,
+                               char *dst)
+{
+    size_t j = 0;
+    for (size_t i = 0; i < len; i++) {
+        const char *code = &uri_encode_tbl[sizeof(int32_t) * src[i]];
+        if (*code) {
+            memcpy(dst + j, code, 3);
+            j += 3;
+        } else {
+            dst[j++] = src[i];
+        }
+    }
+    dst[j] = '\0';
+    return j;
+}
+
+static size_t reference_decode(const unsigned char *src, size_t len,
+                               char *dst)
+{
+    size_t j = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (src[i] == '%' && i + 2 < len &&
+            (hexval[src[i + 1]] | hexval[src[i + 2]]) != 0xFF) {
+            dst[j++] = hexval[src[i + 1]] << 4 | hexval[src[i + 2]];
+            i += 2;
+        } else {
+            dst[j++] = src[i];
+        }
+    }
+    dst[j] = '\0';
+    return j;
+}
+
+// decodes each sequence and checks the code point, instead of the byte
+// ranges uri.c uses
+static bool reference_utf8(const unsigned char *src, size_t len)
+{
+    for (size_t i = 0; i < len;) {
+        unsigned char c = src[i];
+        size_t n;
+        uint32_t cp, min;
+        if (c < 0x80) {
+            i++;
+            continue;
+        } else if ((c & 0xE0) == 0xC0) {
+            n = 2, cp = c & 0x1F, min = 0x80;
+        } else if ((c & 0xF0) == 0xE0) {
+            n = 3, cp = c & 0x0F, min = 0x800;
+        } else if ((c & 0xF8) == 0xF0) {
+            n = 4, cp = c & 0x07, min = 0x10000;
+        } else {
+            return false;
+        }
+        if (n > len - i) {
+            return false;
+        }
+        for (size_t k = 1; k < n; k++) {
+            if ((src[i + k] & 0xC0) != 0x80) {
+                return false;
+            }
+            cp = cp << 6 | (src[i + k] & 0x3F);
+        }
+        if (cp < min || cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF)) {
+            return false;
+        }
+        i += n;
+    }
+    return true;
+}
+
+// mostly plain bytes, with escapes, well-formed and broken UTF-8 and stray
+// bytes mixed in, so runs end at every offset within a block
+static size_t random_input(unsigned char *buf)
+{
+    static const char hex[] = "0123456789abcdefABCDEFxg";
+    static const char *const utf8[] = {"ñ", "用", "ファ", "😀", "\xed\x9f\xbf",
+                                       "\xf4\x8f\xbf\xbf"};
+    size_t len = random_u64() % MAX_LEN;
+    size_t i = 0;
+    while (i < len) {
+        uint64_t r = random_u64();
+        switch (r % 8) {
+        case 0:
+            buf[i++] = '%';
+            buf[i++] = hex[(r >> 8) % (sizeof(hex) - 1)];
+            buf[i++] = hex[(r >> 16) % (sizeof(hex) - 1)];
+            break;
+        case 1: {
+            const char *seq = utf8[(r >> 8) % (sizeof(utf8) / sizeof(*utf8))];
+            size_t n = strlen(seq);
+            // sometimes cut short
+            if ((r >> 16) % 4 == 0) {
+                n = 1 + (r >> 24) % n;
+            }
+            memcpy(buf + i, seq, n);
+            i += n;
+            break;
+        }
+        case 2:
+            buf[i++] = r >> 8;
+            break;
+        default:
+            buf[i++] = "abcXYZ019-._~/ "[(r >> 8) % 15];
+            break;
+        }
+    }
+    return i;
+}
+
+static void report(const char *what, const char *kernel,
+                   const unsigned char *src, size_t len)
+{
+    fprintf(stderr, "uri: %s differs with the %s kernel for:", what, kernel);
+    for (size_t i = 0; i < len; i++) {
+        fprintf(stderr, " %02x", src[i]);
+    }
+    fprintf(stderr, "\n");
+}
+
+static bool same(const char *expected, size_t expected_len,
+                 const char *actual, size_t actual_len)
+{
+    return actual_len == expected_len &&
+           memcmp(actual, expected, expected_len + 1) == 0;
+}
+
+int main(void)
+{
+    // random_input may overshoot MAX_LEN by one UTF-8 sequence
+    unsigned char src[MAX_LEN + 8];
+    static char expected[3 * sizeof(src) + 1], actual[3 * sizeof(src) + 1];
+    int failures = 0;
+
+    for (int round = 0; round < ROUNDS && failures == 0; round++) {
+        size_t len = random_input(src);
+        size_t encoded_len = reference_encode(src, len, expected);
+        bool expected_valid = reference_utf8(src, len);
+
+        for (size_t k = 0; k < sizeof(kernels) / sizeof(*kernels); k++) {
+            if (uri_set_kernel(kernels[k]) < 0) {
+                continue;
+            }
+            bool valid = true;
+            size_t actual_len =
+                uri_encode_utf8((const char *)src, len, actual, &valid);
+            if (!same(expected, encoded_len, actual, actual_len)) {
+                report("uri_encode_utf8", kernels[k], src, len);
+                failures++;
+            }
+            if (valid != expected_valid) {
+                report("UTF-8 validity", kernels[k], src, len);
+                failures++;
+            }
+            actual_len = uri_encode((const char *)src, len, actual);
+            if (!same(expected, encoded_len, actual, actual_len)) {
+                report("uri_encode", kernels[k], src, len);
+                failures++;
+            }
+        }
+
+        // the input already has escapes in it, valid and not
+        size_t decoded_len = reference_decode(src, len, expected);
+        for (size_t k = 0; k < sizeof(kernels) / sizeof(*kernels); k++) {
+            if (uri_set_kernel(kernels[k]) < 0) {
+                continue;
+            }
+            size_t actual_len = uri_decode((const char *)src, len, actual);
+            if (!same(expected, decoded_len, actual, actual_len)) {
+                report("uri_decode", kernels[k], src, len);
+                failures++;
+            }
+        }
+    }
+
+    for (size_t k = 0; k < sizeof(kernels) / sizeof(*kernels); k++) {
+        printf("uri: %s kernel %s\n", kernels[k],
+               uri_set_kernel(kernels[k]) < 0 ? "not available" : "checked");
+    }
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}